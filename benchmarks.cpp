@@ -0,0 +1,327 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include "internal_ptr.hpp"
+#include <thread>
+#include <vector>
+
+template <typename F> double time_seconds(F f) {
+    auto const start = std::chrono::steady_clock::now();
+    f();
+    auto const finish = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(finish - start).count();
+}
+
+void report(char const *name, unsigned nodes, double seconds) {
+    std::cout << std::setw(40) << std::left << name << std::setw(10)
+              << std::right << nodes << std::setw(12) << std::fixed
+              << std::setprecision(3) << seconds * 1e3 << " ms"
+              << std::setw(10) << std::setprecision(1)
+              << seconds * 1e9 / nodes << " ns/node" << std::endl;
+}
+
+template <typename T> double time_walk(jss::root_ptr<T> const &root) {
+    return time_seconds([&] {
+        jss::for_each_reachable(root, [](T &) {});
+    });
+}
+
+// Both walking a structure and dropping it visit every node, so while
+// collection is linear in the size of the structure the ratio of the two
+// stays about the same at every size. Searching for an owner afresh from
+// each child of an unreachable node, as collection did before it counted
+// edges, makes the ratio grow in proportion to the size instead.
+//
+// Time per node still grows with the size once the nodes no longer fit in
+// the cache, and it grows faster for the drop, which makes more passes
+// over the nodes than the walk and, for nodes from make_root, also hands
+// every block back to the heap in an order unrelated to the one they were
+// allocated in. Freeing scattered blocks alone costs several times more
+// per block at a million nodes than at a thousand, so the ratio for the
+// unpooled cyclic graph creeps up with the size (about 2 to about 8 on the
+// machine these were run on) even though the collector does the same work
+// per node. Pooled nodes go back to their slabs without touching the heap,
+// and their ratio, which stays at about 3 to 4 above the smallest size, is
+// the one that shows whether collection is linear
+void report_against_walk(double drop_seconds, double walk_seconds) {
+    std::cout << std::setw(50) << std::left << "  drop time / walk time"
+              << std::setw(12) << std::right << std::setprecision(2)
+              << drop_seconds / walk_seconds << std::endl;
+}
+
+struct GraphNode : jss::internal_base {
+    jss::internal_ptr<GraphNode> next, other;
+
+    GraphNode() : next(this), other(this) {}
+};
+
+template <typename Make> void drop_cyclic_graph(char const *name, Make make) {
+    std::cout << __FUNCTION__ << std::endl;
+    for (unsigned n = 1000; n <= 1024000; n *= 4) {
+        std::vector<jss::root_ptr<GraphNode>> nodes;
+        for (unsigned i = 0; i < n; ++i)
+            nodes.push_back(make());
+        for (unsigned i = 0; i < n; ++i) {
+            nodes[i]->next = nodes[(i + 1) % n];
+            nodes[i]->other = nodes[(i * 7919 + 13) % n];
+        }
+        auto head = nodes[0];
+        nodes.clear();
+        auto const walk_seconds = time_walk(head);
+        auto const seconds = time_seconds([&] { head.reset(); });
+        report(name, n, seconds);
+        report_against_walk(seconds, walk_seconds);
+    }
+}
+
+// Each node of the spine is kept alive by its own root_ptr and points at
+// a node in a dying chain, so the dying nodes have many reachable children
+void drop_chain_with_reachable_children() {
+    std::cout << __FUNCTION__ << std::endl;
+    for (unsigned n = 1000; n <= 256000; n *= 4) {
+        std::vector<jss::root_ptr<GraphNode>> spine;
+        auto head = jss::make_root<GraphNode>();
+        jss::local_ptr<GraphNode> node = head;
+        for (unsigned i = 0; i < n; ++i) {
+            spine.push_back(jss::make_root<GraphNode>());
+            if (i)
+                spine[i]->next = spine[i - 1];
+            node->other = spine.back();
+            node->next = jss::make_root<GraphNode>();
+            node = node->next;
+        }
+        auto const walk_seconds = time_walk(head);
+        auto const seconds = time_seconds([&] { head.reset(); });
+        report("chain with reachable children", n, seconds);
+        report_against_walk(seconds, walk_seconds);
+    }
+}
+
+struct FanOutNode : jss::internal_base {
+    std::vector<jss::internal_ptr<GraphNode>> edges;
+};
+
+// Growing the vector moves every registered pointer, and destroying the
+// node deregisters them all
+void node_with_many_edges() {
+    std::cout << __FUNCTION__ << std::endl;
+    for (unsigned n = 1000; n <= 256000; n *= 4) {
+        auto target = jss::make_root<GraphNode>();
+        auto node = jss::make_root<FanOutNode>();
+        report("build edges", n, time_seconds([&] {
+                   for (unsigned i = 0; i < n; ++i)
+                       node->edges.emplace_back(node.get(), target);
+               }));
+        report("destroy edges", n, time_seconds([&] { node.reset(); }));
+    }
+}
+
+struct FanOutVectorNode : jss::internal_base {
+    jss::internal_ptr_vector<GraphNode> edges;
+
+    FanOutVectorNode() : edges(this) {}
+};
+
+void node_with_edge_vector() {
+    std::cout << __FUNCTION__ << std::endl;
+    for (unsigned n = 1000; n <= 256000; n *= 4) {
+        std::vector<jss::root_ptr<GraphNode>> targets;
+        for (unsigned i = 0; i < n; ++i)
+            targets.push_back(jss::make_root<GraphNode>());
+        auto node = jss::make_root<FanOutVectorNode>();
+        report("build edge vector", n, time_seconds([&] {
+                   for (auto const &target : targets)
+                       node->edges.push_back(target);
+               }));
+        targets.clear();
+        report("clear edge vector", n, time_seconds([&] {
+                   node->edges.clear();
+               }));
+    }
+}
+
+struct DeepRoot {
+    virtual ~DeepRoot() {}
+};
+
+template <unsigned Depth> struct DeepLevel : DeepLevel<Depth - 1> {};
+
+template <> struct DeepLevel<0> : DeepRoot {};
+
+struct DeepNode : DeepLevel<16>, jss::internal_base {
+    jss::internal_ptr<DeepNode> next, other;
+
+    DeepNode() : next(this), other(this) {}
+};
+
+// The control blocks only know the nodes by a base class that is not
+// derived from internal_base, so finding the internal_base needs a
+// cross-cast
+jss::root_ptr<DeepNode> make_deep_node() {
+    jss::root_ptr<DeepLevel<16>> base(new DeepNode);
+    return jss::root_ptr<DeepNode>(base, static_cast<DeepNode *>(base.get()));
+}
+
+// Before each control block cached its internal_base, a scan paid for the
+// cross-cast every time it visited a node, which is at least twice per
+// node when a structure is dropped. The second line times one such cast
+// for every node, as a baseline for what the cache saves
+void drop_deep_hierarchy_graph() {
+    std::cout << __FUNCTION__ << std::endl;
+    for (unsigned n = 1000; n <= 256000; n *= 4) {
+        std::vector<jss::root_ptr<DeepNode>> nodes;
+        for (unsigned i = 0; i < n; ++i)
+            nodes.push_back(make_deep_node());
+        for (unsigned i = 0; i < n; ++i) {
+            nodes[i]->next = nodes[(i + 1) % n];
+            nodes[i]->other = nodes[(i * 7919 + 13) % n];
+        }
+        std::vector<DeepLevel<16> *> bases;
+        for (auto const &node : nodes)
+            bases.push_back(node.get());
+        jss::internal_base *volatile found = nullptr;
+        auto const cast_seconds = time_seconds([&] {
+            for (auto base : bases)
+                found = dynamic_cast<jss::internal_base *>(base);
+        });
+        auto head = nodes[0];
+        nodes.clear();
+        report(
+            "deep hierarchy graph", n, time_seconds([&] { head.reset(); }));
+        report("  one cross-cast per node", n, cast_seconds);
+    }
+}
+
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+struct SlotHub : jss::internal_base {
+    std::vector<jss::internal_ptr<GraphNode>> slots;
+
+    explicit SlotHub(unsigned n) {
+        slots.reserve(n);
+        for (unsigned i = 0; i < n; ++i)
+            slots.emplace_back(this);
+    }
+};
+
+// Each thread repeatedly hangs a small cycle off its own slot of a shared
+// node, and then drops it, so the threads only share the hub
+void concurrent_updates_scaling() {
+    std::cout << __FUNCTION__ << std::endl;
+    unsigned const rounds = 20000;
+    unsigned const max_threads =
+        std::max(4u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        auto hub = jss::make_root<SlotHub>(threads);
+        auto const seconds = time_seconds([&] {
+            std::vector<std::thread> workers;
+            for (unsigned t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t] {
+                    for (unsigned r = 0; r < rounds; ++r) {
+                        auto a = jss::make_root<GraphNode>();
+                        a->next = jss::make_root<GraphNode>();
+                        a->next->next = a;
+                        hub->slots[t] = a;
+                        a.reset();
+                        hub->slots[t].reset();
+                    }
+                });
+            }
+            for (auto &w : workers)
+                w.join();
+        });
+        std::cout << std::setw(40) << std::left << "threads" << std::setw(10)
+                  << std::right << threads << std::setw(12) << std::fixed
+                  << std::setprecision(3) << seconds * 1e3 << " ms"
+                  << std::setw(10) << std::setprecision(0)
+                  << threads * rounds / seconds << " cycles/s" << std::endl;
+    }
+}
+#endif
+
+void walk_cyclic_graph() {
+    std::cout << __FUNCTION__ << std::endl;
+    for (unsigned n = 1000; n <= 1024000; n *= 4) {
+        std::vector<jss::root_ptr<GraphNode>> nodes;
+        for (unsigned i = 0; i < n; ++i)
+            nodes.push_back(jss::make_root<GraphNode>());
+        for (unsigned i = 0; i < n; ++i) {
+            nodes[i]->next = nodes[(i + 1) % n];
+            nodes[i]->other = nodes[(i * 7919 + 13) % n];
+        }
+        auto head = nodes[0];
+        nodes.clear();
+        unsigned visited = 0;
+        auto const count = [&](GraphNode &) { ++visited; };
+        report("depth first walk", n, time_seconds([&] {
+                   jss::for_each_reachable(head, count);
+               }));
+        report("breadth first walk", n, time_seconds([&] {
+                   jss::for_each_reachable(
+                       head, count, jss::traversal_order::breadth_first);
+               }));
+        if (visited != 2 * n)
+            std::cout << "visited " << visited << " nodes" << std::endl;
+    }
+}
+
+struct TreeNode : jss::internal_base {
+    jss::internal_ptr<TreeNode> left, right, sibling;
+
+    TreeNode() : left(this), right(this), sibling(this) {}
+};
+
+// A binary tree with links between siblings has no owner once its root is
+// dropped, so every node is examined by the search for unreachable nodes.
+// Thread counts above the number of cores only measure the overhead of the
+// pool, and are marked as such; scaling has only been measured on a single
+// core so far, where extra threads make the drop slower
+void parallel_marking_scaling() {
+    std::cout << __FUNCTION__ << std::endl;
+    unsigned const depth = 20;
+    unsigned const cores = std::max(1u, std::thread::hardware_concurrency());
+    unsigned const max_threads = std::max(4u, cores);
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        jss::set_parallel_marking(threads);
+        auto root = jss::make_root<TreeNode>();
+        std::vector<jss::local_ptr<TreeNode>> level{root}, children;
+        for (unsigned d = 1; d < depth; ++d) {
+            children.clear();
+            for (auto &node : level) {
+                node->left = jss::make_root<TreeNode>();
+                node->right = jss::make_root<TreeNode>();
+                node->left->sibling = node->right;
+                node->right->sibling = node->left;
+                children.push_back(node->left);
+                children.push_back(node->right);
+            }
+            level.swap(children);
+        }
+        level.clear();
+        children.clear();
+        std::cout << std::setw(8) << std::left << "threads" << std::setw(4)
+                  << threads;
+        report(
+            (threads > cores) ? "tree with sibling links (oversubscribed)"
+                              : "tree with sibling links",
+            (1u << depth) - 1, time_seconds([&] { root.reset(); }));
+    }
+    jss::set_parallel_marking(1);
+}
+
+int main() {
+    drop_cyclic_graph("cyclic graph", [] {
+        return jss::make_root<GraphNode>();
+    });
+    drop_cyclic_graph("cyclic graph, pooled", [] {
+        return jss::make_pooled_root<GraphNode>();
+    });
+    drop_chain_with_reachable_children();
+    node_with_many_edges();
+    node_with_edge_vector();
+    drop_deep_hierarchy_graph();
+    walk_cyclic_graph();
+    parallel_marking_scaling();
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+    concurrent_updates_scaling();
+#endif
+}
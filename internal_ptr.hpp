@@ -36,21 +36,74 @@
 #define _JSS_INTERNAL_PTR_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
 #include <type_traits>
+#include <typeinfo>
 #include <vector>
 
+#define JSS_INTERNAL_PTR_SEARCH_DEPTH_FIRST 0
+#define JSS_INTERNAL_PTR_SEARCH_OWNER_FIRST 1
+#define JSS_INTERNAL_PTR_SEARCH_BREADTH_FIRST 2
+
+// The order in which back-pointers are followed when looking for an owner.
+// OWNER_FIRST and BREADTH_FIRST check each back-pointer for an owner as soon
+// as it is found, before following any of them further
+#ifndef JSS_INTERNAL_PTR_SEARCH_ORDER
+#define JSS_INTERNAL_PTR_SEARCH_ORDER JSS_INTERNAL_PTR_SEARCH_OWNER_FIRST
+#endif
+
+// Define JSS_INTERNAL_PTR_THREAD_SAFE to allow different threads to update
+// different pointers in the same structure at the same time
+
 namespace jss {
 
 template <class T> class root_ptr;
 template <class T> class internal_ptr;
+template <class T> class internal_ptr_vector;
+template <class T> class weak_root_ptr;
+template <class T> class weak_internal_ptr;
 class internal_base;
+class root_arena;
 
 template <typename U, typename... Args> root_ptr<U> make_root(Args &&... args);
+template <typename U, typename... Args>
+root_ptr<U> make_pooled_root(Args &&... args);
+template <typename U, typename A, typename... Args>
+root_ptr<U> allocate_root(A const &alloc, Args &&... args);
+
+enum class collection_engine { back_pointer_search, trial_deletion };
+
+enum class traversal_order { depth_first, breadth_first };
+
+struct root_pool_stats {
+    std::size_t slabs;
+    std::size_t capacity;
+    std::size_t in_use;
+};
+
+struct reachability_cache_stats {
+    std::uint64_t searches;
+    std::uint64_t hits;
+    std::uint64_t invalidations;
+};
 
 namespace detail {
 struct root_ptr_data_block_base {};
 
+template <typename T> class weak_ptr_base;
+
 struct internal_ptr_base;
 
 template <class D> struct root_ptr_deleter_base {
@@ -70,322 +123,2356 @@ template <> struct root_ptr_deleter_base<void> {
 };
 
 class root_ptr_header_block_base;
+class region_header;
 
-template <typename T> struct pointer_set {
-    std::vector<T *> vec;
+struct bookkeeping_resources {
+    std::atomic<std::pmr::memory_resource *> global{
+        std::pmr::new_delete_resource()};
 
-    template <typename V> static auto find_bp_pos(V &v, T *p) {
-        return std::lower_bound(v.begin(), v.end(), p, std::less<T *>());
+    static bookkeeping_resources &instance() {
+        static bookkeeping_resources resources;
+        return resources;
     }
 
-    bool contains(T *p) const {
-        auto pos = find_bp_pos(vec, p);
-        return (pos != vec.end()) && (*pos == p);
+    static std::pmr::memory_resource *&scoped() {
+        static thread_local std::pmr::memory_resource *resource = nullptr;
+        return resource;
     }
 
-    void add(T *p) {
-        auto pos = find_bp_pos(vec, p);
-        vec.insert(pos, p);
+    static std::pmr::memory_resource *current() {
+        auto const resource = scoped();
+        return resource ? resource : instance().global.load();
     }
+};
 
-    bool add_unique(T *p) {
-        auto pos = find_bp_pos(vec, p);
-        if ((pos != vec.end()) && (*pos == p))
-            return false;
-        vec.insert(pos, p);
-        return true;
-    }
+// Heap storage comes from the bookkeeping resource in effect when it is
+// allocated, and records that resource so it is given back to it
+template <typename T> class pointer_set {
+    static constexpr unsigned inline_capacity = 2;
+    static constexpr unsigned hashed = 0;
+    static constexpr unsigned hash_threshold = 64;
+
+    struct hash_table {
+        std::pmr::memory_resource *resource;
+        std::size_t slots;
+        std::size_t used;
+        std::size_t distinct;
+
+        T **keys() {
+            return reinterpret_cast<T **>(this + 1);
+        }
+        unsigned *counts() {
+            return reinterpret_cast<unsigned *>(keys() + slots);
+        }
 
-    void remove(T *p) {
-        auto pos = find_bp_pos(vec, p);
-        if ((pos != vec.end()) && (*pos == p))
-            vec.erase(pos);
+        static std::size_t bytes_for(std::size_t slots) {
+            return sizeof(hash_table) +
+                   slots * (sizeof(T *) + sizeof(unsigned));
+        }
+
+        static hash_table *create(std::size_t slots) {
+            auto const resource = bookkeeping_resources::current();
+            auto table = static_cast<hash_table *>(
+                resource->allocate(bytes_for(slots), alignof(hash_table)));
+            table->resource = resource;
+            table->slots = slots;
+            table->used = 0;
+            table->distinct = 0;
+            std::fill(table->keys(), table->keys() + slots, nullptr);
+            return table;
+        }
+
+        static void destroy(hash_table *table) {
+            table->resource->deallocate(
+                table, bytes_for(table->slots), alignof(hash_table));
+        }
+
+        std::size_t find_slot(T *p) {
+            auto const mask = slots - 1;
+            auto index = hash(p) & mask;
+            auto const k = keys();
+            while (k[index] != p) {
+                if (!k[index])
+                    return slots;
+                index = (index + 1) & mask;
+            }
+            return index;
+        }
+
+        void insert(T *p, unsigned n) {
+            auto const mask = slots - 1;
+            auto index = hash(p) & mask;
+            auto const k = keys();
+            auto insert_pos = slots;
+            while (k[index]) {
+                if (k[index] == p) {
+                    counts()[index] += n;
+                    return;
+                }
+                if ((k[index] == tombstone()) && (insert_pos == slots))
+                    insert_pos = index;
+                index = (index + 1) & mask;
+            }
+            if (insert_pos == slots) {
+                insert_pos = index;
+                ++used;
+            }
+            k[insert_pos] = p;
+            counts()[insert_pos] = n;
+            ++distinct;
+        }
+    };
+
+    unsigned count;
+    unsigned capacity;
+    union {
+        T *local[inline_capacity];
+        T **heap;
+        hash_table *table;
+    };
+
+    // A sorted array on the heap is preceded by its resource
+    static T **allocate_array(unsigned size) {
+        auto const resource = bookkeeping_resources::current();
+        auto const block =
+            static_cast<std::pmr::memory_resource **>(resource->allocate(
+                sizeof(resource) + size * sizeof(T *), alignof(T *)));
+        *block = resource;
+        return reinterpret_cast<T **>(block + 1);
     }
 
-    auto begin() const {
-        return vec.begin();
+    static void deallocate_array(T **array, unsigned size) {
+        auto const block =
+            reinterpret_cast<std::pmr::memory_resource **>(array) - 1;
+        (*block)->deallocate(
+            block, sizeof(*block) + size * sizeof(T *), alignof(T *));
     }
-    auto end() const {
-        return vec.end();
+
+    static T *tombstone() {
+        return reinterpret_cast<T *>(std::uintptr_t(1));
     }
 
-    auto size() const {
-        return vec.size();
+    static std::size_t hash(T *p) {
+        return static_cast<std::size_t>(
+            (reinterpret_cast<std::uintptr_t>(p) >> 4) * 0x9e3779b97f4a7c15ull >>
+            16);
     }
 
-    void clear() {
-        vec.clear();
+    bool is_inline() const {
+        return capacity == inline_capacity;
     }
-};
 
-class root_ptr_header_block_base {
-    unsigned owner_count;
-    unsigned internal_count;
-    pointer_set<root_ptr_header_block_base> back_pointers;
-    bool unreachable;
-    bool deleted;
+    bool is_hashed() const {
+        return capacity == hashed;
+    }
 
-    void check_reachable();
-    static bool check_reachable(
-        pointer_set<root_ptr_header_block_base> &seen_parents,
-        std::vector<root_ptr_header_block_base *> &pending,
-        pointer_set<root_ptr_header_block_base> *unreachable_nodes = nullptr,
-        pointer_set<root_ptr_header_block_base> *owned_nodes = nullptr);
-    void mark_unreachable();
-    static void cleanup_unreachable_nodes(
-        pointer_set<root_ptr_header_block_base> const &seen);
-    static void find_unreachable_children(
-        pointer_set<root_ptr_header_block_base> &seen,
-        std::vector<root_ptr_header_block_base *> &pending);
+    T **data() {
+        return is_inline() ? local : heap;
+    }
 
-    virtual void do_delete() = 0;
-    virtual internal_base *get_internal_base() = 0;
+    T *const *data() const {
+        return is_inline() ? local : heap;
+    }
 
-    bool is_owned() const {
-        if (owner_count) {
-            return true;
-        }
-        if (internal_count > back_pointers.size()) {
-            return true;
+    void reallocate(unsigned new_capacity) {
+        T **const old_data = data();
+        bool const was_inline = is_inline();
+        if (new_capacity <= inline_capacity) {
+            T *temp[inline_capacity];
+            std::copy(old_data, old_data + count, temp);
+            if (!was_inline)
+                deallocate_array(old_data, capacity);
+            std::copy(temp, temp + count, local);
+            capacity = inline_capacity;
+            return;
         }
-        return false;
+        T **const new_data = allocate_array(new_capacity);
+        std::copy(old_data, old_data + count, new_data);
+        if (!was_inline)
+            deallocate_array(old_data, capacity);
+        heap = new_data;
+        capacity = new_capacity;
     }
 
-    void dec_internal_count() {
-        if (!--internal_count) {
-            free_self();
-        } else if (!unreachable && !owner_count) {
-            check_reachable();
+    static std::size_t table_size_for(std::size_t distinct) {
+        std::size_t slots = 16;
+        while (slots < distinct * 2)
+            slots *= 2;
+        return slots;
+    }
+
+    void rehash(std::size_t slots) {
+        auto const old_table = table;
+        auto const new_table = hash_table::create(slots);
+        for (std::size_t i = 0; i != old_table->slots; ++i) {
+            auto const key = old_table->keys()[i];
+            if (key && (key != tombstone()))
+                new_table->insert(key, old_table->counts()[i]);
         }
+        hash_table::destroy(old_table);
+        table = new_table;
     }
 
-    void delete_object() {
-        if (!deleted) {
-            deleted = true;
-            do_delete();
+    void convert_to_hashed() {
+        auto const new_table = hash_table::create(table_size_for(count));
+        for (auto p : *this)
+            new_table->insert(p, 1);
+        if (!is_inline())
+            deallocate_array(heap, capacity);
+        table = new_table;
+        capacity = hashed;
+    }
+
+    void convert_to_sorted() {
+        auto const old_table = table;
+        unsigned new_capacity = inline_capacity;
+        while (new_capacity < count)
+            new_capacity *= 2;
+        T *temp[inline_capacity];
+        T **const new_data =
+            (new_capacity == inline_capacity) ? temp
+                                              : allocate_array(new_capacity);
+        T **out = new_data;
+        for (std::size_t i = 0; i != old_table->slots; ++i) {
+            auto const key = old_table->keys()[i];
+            if (key && (key != tombstone()))
+                out = std::fill_n(out, old_table->counts()[i], key);
         }
+        hash_table::destroy(old_table);
+        std::sort(new_data, out, std::less<T *>());
+        capacity = new_capacity;
+        if (new_capacity == inline_capacity)
+            std::copy(temp, temp + count, local);
+        else
+            heap = new_data;
     }
 
-    void free_self() {
-        if (unreachable)
-            return;
-        pointer_set<root_ptr_header_block_base> seen;
-        std::vector<root_ptr_header_block_base *> pending;
-        seen.add(this);
-        find_unreachable_children(seen, pending);
-        cleanup_unreachable_nodes(seen);
+    T **insert_at(T **pos, T *p) {
+        if (count == capacity) {
+            auto const offset = pos - data();
+            reallocate(capacity * 2);
+            pos = data() + offset;
+        }
+        std::copy_backward(pos, data() + count, data() + count + 1);
+        *pos = p;
+        ++count;
+        return pos;
     }
 
-  public:
-    void add_back_pointer(root_ptr_header_block_base *p) {
-        back_pointers.add(p);
+    // Release the heap storage the current contents do not need, returning
+    // to the inline buffer once the entries fit
+    void shrink_to_fit() {
+        if (is_hashed())
+            convert_to_sorted();
+        else if (!is_inline())
+            reallocate(count);
     }
-    void reachable_from(internal_base *p);
-    void not_reachable_from(internal_base *p);
-    unsigned use_count() {
-        return unreachable ? 0 : internal_count;
+
+    template <typename V> static auto find_bp_pos(V *v, unsigned n, T *p) {
+        return std::lower_bound(v, v + n, p, std::less<T *>());
     }
 
-    virtual ~root_ptr_header_block_base() {}
+  public:
+    class const_iterator {
+        T *const *pos;
+        T *const *last;
 
-    root_ptr_header_block_base()
-        : owner_count(1), internal_count(1), unreachable(false),
-          deleted(false) {}
+        void skip_empty() {
+            while ((pos != last) && (!*pos || (*pos == tombstone())))
+                ++pos;
+        }
 
-    bool is_unreachable() {
-        return unreachable;
-    }
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T *value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef T *const *pointer;
+        typedef T *const &reference;
 
-    void remove_owner() {
-        --owner_count;
-        dec_internal_count();
-    }
+        const_iterator(T *const *pos_, T *const *last_)
+            : pos(pos_), last(last_) {
+            skip_empty();
+        }
 
-    bool owner_from_internal() {
-        if (unreachable)
-            return false;
-        ++owner_count;
-        ++internal_count;
-        return true;
-    }
+        reference operator*() const {
+            return *pos;
+        }
 
-    void set_owner();
+        const_iterator &operator++() {
+            ++pos;
+            skip_empty();
+            return *this;
+        }
 
-    void add_owner() {
-        ++owner_count;
-        ++internal_count;
+        const_iterator operator++(int) {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+
+        friend bool
+        operator==(const_iterator const &lhs, const_iterator const &rhs) {
+            return lhs.pos == rhs.pos;
+        }
+
+        friend bool
+        operator!=(const_iterator const &lhs, const_iterator const &rhs) {
+            return lhs.pos != rhs.pos;
+        }
+    };
+
+    pointer_set() noexcept : count(0), capacity(inline_capacity) {}
+
+    pointer_set(pointer_set const &) = delete;
+    pointer_set &operator=(pointer_set const &) = delete;
+
+    ~pointer_set() {
+        if (is_hashed())
+            hash_table::destroy(table);
+        else if (!is_inline())
+            deallocate_array(heap, capacity);
     }
-};
 
-template <class P> struct root_ptr_header_block : root_ptr_header_block_base {};
+    void add(T *p) {
+        if (!is_hashed() && (count == capacity) && (count >= hash_threshold))
+            convert_to_hashed();
+        if (is_hashed()) {
+            if ((table->used + 1) * 4 > table->slots * 3)
+                rehash(table_size_for(table->distinct + 1));
+            table->insert(p, 1);
+            ++count;
+            return;
+        }
+        insert_at(find_bp_pos(data(), count, p), p);
+    }
 
-template <typename T,
-          bool = std::is_polymorphic<typename std::remove_cv<T>::type>::value>
-struct get_internal_base_helper {
-    static internal_base *get_internal_base(T *p) {
-        return dynamic_cast<internal_base *>(p);
+    void remove(T *p) {
+        if (is_hashed()) {
+            auto const slot = table->find_slot(p);
+            if (slot == table->slots)
+                return;
+            --count;
+            if (!--table->counts()[slot]) {
+                table->keys()[slot] = tombstone();
+                --table->distinct;
+            }
+            if (count < hash_threshold / 4)
+                shrink_to_fit();
+            return;
+        }
+        auto pos = find_bp_pos(data(), count, p);
+        if ((pos != data() + count) && (*pos == p)) {
+            std::copy(pos + 1, data() + count, pos);
+            --count;
+            if (!is_inline() && (count <= capacity / 4))
+                shrink_to_fit();
+        }
     }
-};
 
-template <typename T> struct get_internal_base_helper<T, false> {
-    static internal_base *get_internal_base(T *) {
-        return nullptr;
+    // In the hashed representation each distinct entry is visited once,
+    // however many times it has been added
+    const_iterator begin() const {
+        if (is_hashed())
+            return const_iterator(table->keys(), table->keys() + table->slots);
+        return const_iterator(data(), data() + count);
+    }
+    const_iterator end() const {
+        if (is_hashed())
+            return const_iterator(
+                table->keys() + table->slots, table->keys() + table->slots);
+        return const_iterator(data() + count, data() + count);
     }
+
+    unsigned size() const {
+        return count;
+    }
+
 };
 
-template <typename T> internal_base *get_internal_base_impl(T *p) {
-    return get_internal_base_helper<T>::get_internal_base(p);
+inline void prefetch(void const *p) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
 }
 
-template <class P, class D>
-struct root_ptr_header_separate : public root_ptr_header_block<P>,
-                                  private root_ptr_deleter_base<D> {
-    P const ptr;
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+typedef std::atomic<unsigned> weak_counter;
 
-    internal_base *get_internal_base() {
-        return get_internal_base_impl(ptr);
-    }
+// Each header and node is guarded by one of a fixed set of locks, chosen by
+// its address. Updating an edge only takes the locks of the objects it
+// touches, while a collection takes all of them, so it sees a consistent
+// graph. There are few enough that a collection holding them all can
+// still take other locks without passing the 64 held locks that lock
+// checkers such as ThreadSanitizer can track
+class graph_locks {
+    static constexpr unsigned stripe_bits = 5;
 
-    root_ptr_header_separate(P p) : ptr(p) {}
+    struct alignas(64) stripe {
+        std::mutex mutex;
+    };
 
-    template <typename D2>
-    root_ptr_header_separate(P p, D2 &d)
-        : root_ptr_deleter_base<D>(d), ptr(p) {}
+    stripe stripes[1 << stripe_bits];
 
-    void do_delete() {
-        root_ptr_deleter_base<D>::do_delete(ptr);
+    static graph_locks &instance() {
+        static graph_locks locks;
+        return locks;
     }
-};
 
-template <class T>
-struct root_ptr_header_combined : public root_ptr_header_block<T *> {
-    typedef
-        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_type;
-    storage_type storage;
+  public:
+    // Non-zero while this thread holds every lock, so whatever it does
+    // inside a collection, such as running destructors, takes no more
+    static unsigned &world_depth() {
+        static thread_local unsigned depth = 0;
+        return depth;
+    }
 
-    T *value() {
-        return static_cast<T *>(get_base_ptr());
+    static std::mutex *stripe_for(void const *p) {
+        auto const index = (reinterpret_cast<std::uintptr_t>(p) >> 4) *
+                               0x9e3779b97f4a7c15ull >>
+                           (64 - stripe_bits);
+        return &instance().stripes[index].mutex;
     }
 
-    void *get_base_ptr() {
-        return &storage;
+    static void lock_world() {
+        for (auto &s : instance().stripes)
+            s.mutex.lock();
     }
 
-    internal_base *get_internal_base() {
-        return get_internal_base_impl(value());
+    static void unlock_world() {
+        for (auto &s : instance().stripes)
+            s.mutex.unlock();
     }
+};
 
-    template <typename... Args> root_ptr_header_combined(Args &&... args) {
-        new (get_base_ptr()) T(static_cast<Args &&>(args)...);
+// Locks are always taken in address order, and never while holding a
+// stripe_guard, so they cannot deadlock
+class stripe_guard {
+    std::mutex *first;
+    std::mutex *second;
+
+  public:
+    explicit stripe_guard(void const *p, void const *q = nullptr)
+        : first(nullptr), second(nullptr) {
+        if (graph_locks::world_depth())
+            return;
+        first = graph_locks::stripe_for(p);
+        if (q)
+            second = graph_locks::stripe_for(q);
+        if (second == first)
+            second = nullptr;
+        else if (second && (second < first))
+            std::swap(first, second);
+        first->lock();
+        if (second)
+            second->lock();
     }
 
-    void do_delete() {
-        value()->~T();
+    stripe_guard(stripe_guard const &) = delete;
+    stripe_guard &operator=(stripe_guard const &) = delete;
+
+    ~stripe_guard() {
+        if (second)
+            second->unlock();
+        if (first)
+            first->unlock();
     }
 };
 
-struct internal_ptr_base {
-    internal_base *base;
-    root_ptr_header_block_base *header;
-    internal_ptr_base *next;
+class world_guard {
+  public:
+    world_guard() {
+        if (!graph_locks::world_depth()++)
+            graph_locks::lock_world();
+    }
 
-    internal_ptr_base(internal_base *base_, root_ptr_header_block_base *header_)
-        : base(base_), header(header_), next(nullptr) {}
+    world_guard(world_guard const &) = delete;
+    world_guard &operator=(world_guard const &) = delete;
+
+    ~world_guard() {
+        if (!--graph_locks::world_depth())
+            graph_locks::unlock_world();
+    }
 };
-}
 
-template <class T> class root_ptr {
-  private:
-    T *ptr;
-    detail::root_ptr_header_block_base *header;
+// Both counts share one word, so a thread dropping a reference sees them
+// as they were at the moment of its own decrement
+class reference_counts {
+    static constexpr std::uint64_t owner_unit = std::uint64_t(1) << 32;
 
-    template <typename U> friend class root_ptr;
-    template <typename U> friend class internal_ptr;
-    friend class internal_base;
-    friend class detail::root_ptr_header_block_base;
+    std::atomic<std::uint64_t> value;
 
-    template <typename U, typename... Args>
-    friend root_ptr<U> make_root(Args &&... args);
+  public:
+    reference_counts() : value(owner_unit + 1) {}
 
-    root_ptr(detail::root_ptr_header_block_base *header_, T *ptr_)
-        : ptr(ptr_), header(header_) {
-        if (header && !header->owner_from_internal()) {
-            ptr = nullptr;
-            header = nullptr;
-        }
+    unsigned owners() const {
+        return unsigned(value.load() >> 32);
+    }
+    unsigned internal() const {
+        return unsigned(value.load());
     }
 
-    root_ptr(detail::root_ptr_header_combined<T> *header_)
-        : ptr(header_->value()), header(header_) {
-        header->set_owner();
+    void add_owner() {
+        value.fetch_add(owner_unit + 1);
+    }
+    void remove_owner() {
+        value.fetch_sub(owner_unit + 1);
+    }
+    // Drops an owner without taking a lock, as long as another remains
+    bool remove_shared_owner() {
+        auto current = value.load();
+        while ((current >> 32) > 1) {
+            if (value.compare_exchange_weak(current, current - owner_unit - 1))
+                return true;
+        }
+        return false;
     }
 
-    void clear() {
-        header = nullptr;
-        ptr = nullptr;
+    void add_internal() {
+        value.fetch_add(1);
     }
+    void remove_internal() {
+        value.fetch_sub(1);
+    }
+};
 
-  public:
-    typedef T element_type;
-    constexpr root_ptr() noexcept : ptr(nullptr), header(nullptr) {}
+typedef std::atomic<bool> shared_flag;
 
-    template <class Y>
-    explicit root_ptr(Y *p) try
-        : ptr(p),
-          header(new detail::root_ptr_header_separate<Y *, void>(p)) {
-        header->set_owner();
-    } catch (...) {
-        delete p;
-    }
+struct queue_link {
+    std::atomic<queue_link *> queue_next{nullptr};
+};
 
-    template <class Y, class D>
-    root_ptr(Y *p, D d) try
-        : ptr(p),
-          header(new detail::root_ptr_header_separate<Y *, D>(p, d)) {
-        header->set_owner();
-    } catch (...) {
-        d(p);
-    }
+// Headers waiting to be checked by the collector. Any thread can push
+// without locking; this is Vyukov's intrusive multi-producer
+// single-consumer queue, so consumers take consumer_mutex.
+class collection_queue {
+    queue_link stub;
+    std::atomic<queue_link *> head;
+    queue_link *tail;
 
-    template <class D>
-    root_ptr(std::nullptr_t p, D d) try
-        : ptr(p),
-          header(
-              new detail::root_ptr_header_separate<std::nullptr_t, D>(p, d)) {
-        header->set_owner();
-    } catch (...) {
-        d(p);
+  public:
+    std::atomic<bool> enabled{false};
+    std::atomic<std::size_t> size{0};
+    // Headers taken from the queue whose collection has not yet finished
+    std::atomic<std::size_t> in_flight{0};
+    std::mutex consumer_mutex;
+
+    // The collector thread sleeps on wake when the queue is empty, and
+    // threads waiting for queued work to finish sleep on idle
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<bool> sleeping{false};
+
+    collection_queue() : head(&stub), tail(&stub) {}
+
+    void push(queue_link *node) {
+        ++size;
+        node->queue_next.store(nullptr, std::memory_order_relaxed);
+        head.exchange(node)->queue_next.store(node);
+        if (sleeping) {
+            std::lock_guard<std::mutex> guard(wake_mutex);
+            wake.notify_one();
+        }
     }
 
-    template <class Y>
-    root_ptr(const root_ptr<Y> &r, T *p) noexcept : ptr(p), header(r.header) {
-        if (header)
-            header->add_owner();
+    // Returns nullptr if the queue is empty, or a push is half done
+    queue_link *pop() {
+        auto last = tail;
+        auto next = last->queue_next.load();
+        if (last == &stub) {
+            if (!next)
+                return nullptr;
+            tail = last = next;
+            next = next->queue_next.load();
+        }
+        if (!next) {
+            if (last != head.load())
+                return nullptr;
+            stub.queue_next.store(nullptr, std::memory_order_relaxed);
+            head.exchange(&stub)->queue_next.store(&stub);
+            next = last->queue_next.load();
+            if (!next)
+                return nullptr;
+        }
+        tail = next;
+        --size;
+        return last;
     }
 
-    root_ptr(const root_ptr &r) noexcept : ptr(r.ptr), header(r.header) {
-        if (header)
-            header->add_owner();
+    void finished(std::size_t taken) {
+        if (taken && !(in_flight -= taken)) {
+            std::lock_guard<std::mutex> guard(wake_mutex);
+            idle.notify_all();
+        }
     }
 
-    template <class Y>
-    root_ptr(const root_ptr<Y> &r) noexcept : ptr(r.ptr), header(r.header) {
-        if (header)
-            header->add_owner();
+    void wait_until_idle() {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        idle.wait(lock, [&] { return !in_flight; });
     }
 
-    root_ptr(root_ptr &&r) noexcept : ptr(r.ptr), header(r.header) {
-        r.clear();
+    static collection_queue &instance() {
+        static collection_queue queue;
+        return queue;
     }
+};
+#else
+typedef unsigned weak_counter;
+typedef bool shared_flag;
 
-    template <class Y>
-    root_ptr(root_ptr<Y> &&r) noexcept : ptr(r.ptr), header(r.header) {
-        r.clear();
-    }
+struct queue_link {};
 
-    template <class Y> explicit root_ptr(const internal_ptr<Y> &r);
+struct stripe_guard {
+    explicit stripe_guard(void const *, void const * = nullptr) {}
+};
 
-    template <class Y, class D>
+struct world_guard {
+    world_guard() {}
+};
+
+class reference_counts {
+    unsigned owner_count;
+    unsigned internal_count;
+
+  public:
+    reference_counts() : owner_count(1), internal_count(1) {}
+
+    unsigned owners() const {
+        return owner_count;
+    }
+    unsigned internal() const {
+        return internal_count;
+    }
+
+    void add_owner() {
+        ++owner_count;
+        ++internal_count;
+    }
+    void remove_owner() {
+        --owner_count;
+        --internal_count;
+    }
+    bool remove_shared_owner() {
+        if (owner_count < 2)
+            return false;
+        remove_owner();
+        return true;
+    }
+
+    void add_internal() {
+        ++internal_count;
+    }
+    void remove_internal() {
+        --internal_count;
+    }
+};
+#endif
+
+// Fixed-size blocks carved out of slabs, with a free list shared between
+// threads, and a small per-thread cache of free blocks in front of it
+class slab_pool {
+    struct free_block {
+        free_block *next;
+    };
+
+    std::mutex mutex;
+    std::size_t const alignment;
+    std::size_t const block_size;
+    std::size_t const blocks_per_slab;
+    std::vector<void *> slabs;
+    free_block *free_list;
+    std::atomic<std::size_t> in_use;
+
+    void add_slab() {
+        auto const slab = static_cast<char *>(::operator new(
+            block_size * blocks_per_slab, std::align_val_t(alignment)));
+        slabs.push_back(slab);
+        for (std::size_t i = blocks_per_slab; i--;) {
+            auto const block = reinterpret_cast<free_block *>(slab + i * block_size);
+            block->next = free_list;
+            free_list = block;
+        }
+    }
+
+  public:
+    static constexpr std::size_t cache_size = 32;
+
+    class thread_cache {
+        slab_pool &pool;
+        free_block *blocks;
+        std::size_t count;
+
+      public:
+        explicit thread_cache(slab_pool &pool_)
+            : pool(pool_), blocks(nullptr), count(0) {}
+
+        thread_cache(thread_cache const &) = delete;
+        thread_cache &operator=(thread_cache const &) = delete;
+
+        ~thread_cache() {
+            flush(0);
+        }
+
+        void *allocate() {
+            if (!blocks) {
+                std::lock_guard<std::mutex> guard(pool.mutex);
+                while (count < cache_size / 2) {
+                    if (!pool.free_list)
+                        pool.add_slab();
+                    auto const block = pool.free_list;
+                    pool.free_list = block->next;
+                    block->next = blocks;
+                    blocks = block;
+                    ++count;
+                }
+            }
+            ++pool.in_use;
+            auto const block = blocks;
+            blocks = block->next;
+            --count;
+            return block;
+        }
+
+        void deallocate(void *p) {
+            --pool.in_use;
+            auto const block = static_cast<free_block *>(p);
+            block->next = blocks;
+            blocks = block;
+            if (++count > cache_size)
+                flush(cache_size / 2);
+        }
+
+        void flush(std::size_t keep) {
+            if (count <= keep)
+                return;
+            std::lock_guard<std::mutex> guard(pool.mutex);
+            while (count > keep) {
+                auto const block = blocks;
+                blocks = block->next;
+                block->next = pool.free_list;
+                pool.free_list = block;
+                --count;
+            }
+        }
+    };
+
+    // Every block is a multiple of the alignment in size, so aligning the
+    // slab aligns every block carved out of it
+    slab_pool(std::size_t block_size_, std::size_t alignment_)
+        : alignment(std::max(alignment_, alignof(std::max_align_t))),
+          block_size((block_size_ + alignment - 1) / alignment * alignment),
+          blocks_per_slab(std::max<std::size_t>(16, 16384 / block_size)),
+          free_list(nullptr), in_use(0) {}
+
+    slab_pool(slab_pool const &) = delete;
+    slab_pool &operator=(slab_pool const &) = delete;
+
+    // Blocks still in use at exit belong to objects that were never
+    // destroyed, so the slabs holding them are deliberately not released
+    ~slab_pool() {
+        if (!in_use) {
+            for (auto slab : slabs)
+                ::operator delete(slab, std::align_val_t(alignment));
+        }
+    }
+
+    // Blocks released together by a bulk teardown go straight back to the
+    // shared free list under a single lock
+    class release_batch {
+        slab_pool *pool = nullptr;
+        free_block *head = nullptr;
+        free_block *tail = nullptr;
+        std::size_t count = 0;
+
+      public:
+        release_batch() = default;
+        release_batch(release_batch const &) = delete;
+        release_batch &operator=(release_batch const &) = delete;
+
+        ~release_batch() {
+            flush();
+        }
+
+        void add(slab_pool *block_pool, void *p) {
+            if (block_pool != pool) {
+                flush();
+                pool = block_pool;
+            }
+            auto const block = static_cast<free_block *>(p);
+            block->next = head;
+            head = block;
+            if (!tail)
+                tail = block;
+            ++count;
+        }
+
+        void flush() {
+            if (!count)
+                return;
+            pool->in_use -= count;
+            std::lock_guard<std::mutex> guard(pool->mutex);
+            tail->next = pool->free_list;
+            pool->free_list = head;
+            head = tail = nullptr;
+            count = 0;
+        }
+    };
+
+    root_pool_stats stats() {
+        std::lock_guard<std::mutex> guard(mutex);
+        return {slabs.size(), slabs.size() * blocks_per_slab, in_use.load()};
+    }
+
+    template <typename T> static slab_pool &instance() {
+        static slab_pool pool(sizeof(T), alignof(T));
+        return pool;
+    }
+
+    template <typename T> static thread_cache &cache() {
+        static thread_local thread_cache local_cache(instance<T>());
+        return local_cache;
+    }
+};
+
+// A scan mark packs the epoch of the scan into the bits above a three-bit
+// colour. Every scan clears the colours it set before it finishes, so the
+// epoch can wrap without an old mark being taken for a new one
+typedef std::uint32_t scan_epoch;
+
+constexpr unsigned colour_bits = 3;
+constexpr scan_epoch colour_mask = (scan_epoch(1) << colour_bits) - 1;
+constexpr scan_epoch epoch_mask = scan_epoch(-1) >> colour_bits;
+
+// Threads scanning unrelated structures each take an epoch of their own,
+// so neither takes the other's marks for its own
+inline scan_epoch next_scan_epoch() {
+    static std::atomic<scan_epoch> last_epoch{0};
+    for (;;) {
+        auto const epoch =
+            (last_epoch.fetch_add(1, std::memory_order_relaxed) + 1) &
+            epoch_mask;
+        if (epoch)
+            return epoch;
+    }
+}
+
+// Headers proven to have a path to an owner are tagged with the current
+// epoch; removing an edge to, or the last owner of, a tagged header may
+// break such a path, so starts a new epoch. Threads scanning unrelated
+// structures share it even in the default build, so it is atomic in both
+// modes; the statistics are only counted, so need no ordering
+struct reachability_cache {
+    class counter {
+        std::atomic<std::uint64_t> value{0};
+
+      public:
+        counter &operator++() {
+            value.fetch_add(1, std::memory_order_relaxed);
+            return *this;
+        }
+        counter &operator=(std::uint64_t new_value) {
+            value.store(new_value, std::memory_order_relaxed);
+            return *this;
+        }
+        operator std::uint64_t() const {
+            return value.load(std::memory_order_relaxed);
+        }
+    };
+
+    struct counters {
+        counter searches;
+        counter hits;
+        counter invalidations;
+    };
+
+    std::atomic<std::uint64_t> epoch{1};
+    counters stats;
+
+    void invalidate() {
+        ++epoch;
+        ++stats.invalidations;
+    }
+
+    static reachability_cache &instance() {
+        static reachability_cache cache;
+        return cache;
+    }
+};
+
+typedef std::pmr::vector<root_ptr_header_block_base *> node_list;
+
+// Buffers kept between scans give their storage back and start again from
+// resource when it is not the one they were allocated from
+inline void rebind(node_list &list, std::pmr::memory_resource *resource) {
+    if (list.get_allocator().resource() != resource) {
+        list.~node_list();
+        new (&list) node_list(resource);
+    }
+}
+
+// Colours and trial counts are only touched by the thread running a scan,
+// except while marking in parallel, when nodes are coloured by
+// compare-exchange and counts are decremented atomically
+template <typename T> class mark_field {
+    std::atomic<T> value;
+
+  public:
+    explicit mark_field(T initial) : value(initial) {}
+
+    operator T() const {
+        return value.load(std::memory_order_relaxed);
+    }
+    mark_field &operator=(T new_value) {
+        value.store(new_value, std::memory_order_relaxed);
+        return *this;
+    }
+    mark_field &operator++() {
+        return *this = *this + 1;
+    }
+    mark_field &operator--() {
+        return *this = *this - 1;
+    }
+
+    T acquire() const {
+        return value.load(std::memory_order_acquire);
+    }
+    void release(T new_value) {
+        value.store(new_value, std::memory_order_release);
+    }
+    bool compare_exchange(T &expected, T desired) {
+        return value.compare_exchange_strong(
+            expected, desired, std::memory_order_acq_rel,
+            std::memory_order_acquire);
+    }
+    void atomic_decrement() {
+        value.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+// A fixed set of threads that share out the nodes of a scan. The calling
+// thread acts as worker 0. Each worker works from a private stack, and
+// moves half of it to its shared queue for others to steal whenever that
+// queue runs dry
+class marking_pool {
+    // Idle workers back off to sleeping, so they do not take the processor
+    // from the busy ones when there are more workers than cores
+    static constexpr unsigned spins_before_sleeping = 64;
+
+    // The workers grow their queues at the same time, so they allocate
+    // through a lock rather than relying on the bookkeeping resource being
+    // safe to share between threads
+    class locked_resource : public std::pmr::memory_resource {
+        std::mutex mutex;
+
+        void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+            std::lock_guard<std::mutex> guard(mutex);
+            return upstream->allocate(bytes, alignment);
+        }
+        void do_deallocate(
+            void *p, std::size_t bytes, std::size_t alignment) override {
+            std::lock_guard<std::mutex> guard(mutex);
+            upstream->deallocate(p, bytes, alignment);
+        }
+        bool do_is_equal(
+            std::pmr::memory_resource const &other) const noexcept override {
+            return this == &other;
+        }
+
+      public:
+        std::pmr::memory_resource *upstream =
+            bookkeeping_resources::instance().global.load();
+    };
+
+    // Other workers steal from the front of shared, which is only compacted
+    // once it runs dry
+    struct alignas(64) worker {
+        node_list local;
+        std::mutex mutex;
+        node_list shared;
+        std::size_t shared_first = 0;
+        std::atomic<bool> has_shared{false};
+        node_list found;
+
+        void release(locked_resource &queues) {
+            for (auto list : {&local, &shared, &found}) {
+                list->~node_list();
+                new (list) node_list(&queues);
+            }
+            shared_first = 0;
+        }
+    };
+
+    unsigned const size;
+    std::mutex claimed;
+    locked_resource queues;
+    std::unique_ptr<worker[]> workers;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    std::uint64_t generation = 0;
+    unsigned running = 0;
+    bool stopping = false;
+    std::function<void(unsigned)> job;
+    std::atomic<unsigned> active{0};
+
+    void worker_main(unsigned index) {
+        std::uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            start.wait(lock, [&] { return stopping || (generation != seen); });
+            if (stopping)
+                return;
+            seen = generation;
+            lock.unlock();
+            job(index);
+            lock.lock();
+            if (!--running)
+                done.notify_one();
+        }
+    }
+
+    template <typename F> void run_all(F f) {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            job = [&f](unsigned index) { f(index); };
+            running = size - 1;
+            ++generation;
+        }
+        start.notify_all();
+        f(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return !running; });
+    }
+
+    void share(worker &w) {
+        if (w.local.size() < 2 || w.has_shared.load(std::memory_order_relaxed))
+            return;
+        auto const half = w.local.begin() + w.local.size() / 2;
+        std::lock_guard<std::mutex> guard(w.mutex);
+        w.shared.insert(w.shared.end(), w.local.begin(), half);
+        w.local.erase(w.local.begin(), half);
+        w.has_shared.store(true, std::memory_order_relaxed);
+    }
+
+    bool take(unsigned index, root_ptr_header_block_base *&node) {
+        auto &own = workers[index];
+        if (!own.local.empty()) {
+            node = own.local.back();
+            own.local.pop_back();
+            return true;
+        }
+        for (unsigned i = 0; i != size; ++i) {
+            auto &w = workers[(index + i) % size];
+            if (!w.has_shared.load(std::memory_order_relaxed))
+                continue;
+            std::lock_guard<std::mutex> guard(w.mutex);
+            if (w.shared_first == w.shared.size())
+                continue;
+            if (i) {
+                node = w.shared[w.shared_first++];
+            } else {
+                node = w.shared.back();
+                w.shared.pop_back();
+            }
+            if (w.shared_first == w.shared.size()) {
+                w.shared.clear();
+                w.shared_first = 0;
+                w.has_shared.store(false, std::memory_order_relaxed);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool any_shared() const {
+        for (unsigned i = 0; i != size; ++i) {
+            if (workers[i].has_shared.load(std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+  public:
+    explicit marking_pool(unsigned size_)
+        : size(size_), workers(new worker[size_]) {
+        for (unsigned i = 0; i != size; ++i)
+            workers[i].release(queues);
+        for (unsigned i = 1; i != size; ++i)
+            threads.emplace_back(&marking_pool::worker_main, this, i);
+    }
+
+    marking_pool(marking_pool const &) = delete;
+    marking_pool &operator=(marking_pool const &) = delete;
+
+    ~marking_pool() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        start.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    unsigned thread_count() const {
+        return size;
+    }
+
+    // Only one scan at a time can use the pool; traverse, use and trim may
+    // only be called while holding a claim
+    std::unique_lock<std::mutex> claim() {
+        return std::unique_lock<std::mutex>(claimed);
+    }
+
+    std::unique_lock<std::mutex> try_claim() {
+        return std::unique_lock<std::mutex>(claimed, std::try_to_lock);
+    }
+
+    // Nodes recorded by each worker during the last traversal
+    node_list &found(unsigned index) {
+        return workers[index].found;
+    }
+
+    // Gives the queues back to the resource they came from, and takes them
+    // from resource from now on
+    void use(std::pmr::memory_resource *resource) {
+        if (resource == queues.upstream)
+            return;
+        for (unsigned i = 0; i != size; ++i)
+            workers[i].release(queues);
+        queues.upstream = resource;
+    }
+
+    // Queues taken from a scoped resource are not kept once the scan is over
+    void trim() {
+        use(bookkeeping_resources::instance().global.load());
+    }
+
+    // Calls expand(index, node, push) for nodes[first, end) and every node
+    // passed to push. A worker only stops once it has no work, there is
+    // none to steal, and no other worker could still share any. The queues
+    // are allocated from the same resource as nodes
+    template <typename Expand>
+    void traverse(node_list const &nodes, std::size_t first, Expand expand) {
+        use(nodes.get_allocator().resource());
+        for (unsigned i = 0; i != size; ++i)
+            workers[i].found.clear();
+        for (auto i = first; i != nodes.size(); ++i)
+            workers[i % size].local.push_back(nodes[i]);
+        active = size;
+        run_all([&](unsigned index) {
+            auto &own = workers[index];
+            auto const push = [&](root_ptr_header_block_base *node) {
+                own.local.push_back(node);
+            };
+            root_ptr_header_block_base *node;
+            for (;;) {
+                while (take(index, node)) {
+                    expand(index, node, push);
+                    share(own);
+                }
+                active.fetch_sub(1, std::memory_order_acq_rel);
+                for (unsigned idle = 0;; ++idle) {
+                    if (active.load(std::memory_order_acquire) == 0)
+                        return;
+                    if (idle < spins_before_sleeping)
+                        std::this_thread::yield();
+                    else
+                        std::this_thread::sleep_for(
+                            std::chrono::microseconds(50));
+                    if (any_shared()) {
+                        active.fetch_add(1, std::memory_order_acq_rel);
+                        break;
+                    }
+                }
+            }
+        });
+    }
+};
+
+struct scan_workspace {
+    static constexpr std::size_t max_retained_entries = 1 << 16;
+
+    std::pmr::memory_resource *const resource;
+    node_list unreachable_nodes;
+    node_list visited;
+    std::pmr::vector<std::size_t> visited_parent;
+    std::pmr::vector<std::size_t> search_stack;
+    node_list pending;
+    node_list reachable;
+    node_list candidates;
+    node_list marked;
+
+    explicit scan_workspace(std::pmr::memory_resource *resource_)
+        : resource(resource_), unreachable_nodes(resource),
+          visited(resource), visited_parent(resource), search_stack(resource),
+          pending(resource), reachable(resource), candidates(resource),
+          marked(resource) {}
+
+    template <typename V> static void reset_vector(V &vec) {
+        vec.clear();
+        if (vec.capacity() > max_retained_entries)
+            V(vec.get_allocator()).swap(vec);
+    }
+
+    void reset() {
+        reset_vector(unreachable_nodes);
+        reset_vector(visited);
+        reset_vector(visited_parent);
+        reset_vector(search_stack);
+        reset_vector(pending);
+        reset_vector(reachable);
+        reset_vector(candidates);
+        reset_vector(marked);
+    }
+};
+
+// Scans can nest, since destroying unreachable nodes runs arbitrary
+// destructors, so each nesting level on a thread gets its own workspace
+struct scan_workspace_pool {
+    std::vector<std::unique_ptr<scan_workspace>> workspaces;
+    std::size_t depth = 0;
+    std::pmr::memory_resource *global = nullptr;
+
+    static scan_workspace_pool &instance() {
+        static thread_local scan_workspace_pool pool;
+        return pool;
+    }
+};
+
+class scan_workspace_lease {
+    scan_workspace_pool &pool;
+    scan_workspace *workspace;
+
+  public:
+    // Workspaces cached from a previous global resource are given back to
+    // it as soon as this thread scans again
+    scan_workspace_lease() : pool(scan_workspace_pool::instance()) {
+        auto const global = bookkeeping_resources::instance().global.load();
+        if (pool.global != global) {
+            pool.workspaces.resize(pool.depth);
+            pool.global = global;
+        }
+        auto const resource = bookkeeping_resources::current();
+        if (pool.depth == pool.workspaces.size())
+            pool.workspaces.emplace_back();
+        auto &slot = pool.workspaces[pool.depth++];
+        if (!slot || (slot->resource != resource))
+            slot.reset(new scan_workspace(resource));
+        workspace = slot.get();
+    }
+
+    scan_workspace_lease(scan_workspace_lease const &) = delete;
+    scan_workspace_lease &operator=(scan_workspace_lease const &) = delete;
+
+    // Only memory from the global resource is kept for later scans, so
+    // nothing outlives a scoped resource
+    ~scan_workspace_lease() {
+        auto &slot = pool.workspaces[--pool.depth];
+        if (workspace->resource ==
+            bookkeeping_resources::instance().global.load())
+            workspace->reset();
+        else
+            slot.reset();
+    }
+
+    scan_workspace *operator->() const {
+        return workspace;
+    }
+
+    scan_workspace &operator*() const {
+        return *workspace;
+    }
+};
+
+struct collection_config {
+    collection_engine engine = collection_engine::back_pointer_search;
+    std::size_t candidate_buffer_size = 1024;
+
+    static collection_config &instance() {
+        static collection_config config;
+        return config;
+    }
+};
+
+// Searches for unreachable nodes are shared across the pool once at least
+// threshold nodes are waiting to be examined
+struct parallel_marking {
+    std::size_t threshold = std::size_t(1) << 16;
+    std::unique_ptr<marking_pool> pool;
+
+    // A scan that finds the pool claimed by another thread does its own
+    // marking instead of waiting
+    marking_pool *
+    pool_for(std::size_t waiting, std::unique_lock<std::mutex> &claim) const {
+        if (!pool || (waiting < threshold))
+            return nullptr;
+        if (!claim.owns_lock())
+            claim = pool->try_claim();
+        return claim.owns_lock() ? pool.get() : nullptr;
+    }
+
+    static parallel_marking &instance() {
+        static parallel_marking config;
+        return config;
+    }
+};
+
+struct collection_state {
+    unsigned defer_depth = 0;
+    node_list candidates{bookkeeping_resources::instance().global.load()};
+
+    // The buffer is retained between collections, so it follows changes to
+    // the global resource whenever it is empty
+    void rebind_candidates() {
+        if (candidates.empty())
+            rebind(
+                candidates, bookkeeping_resources::instance().global.load());
+    }
+
+    void add_candidate(root_ptr_header_block_base *p) {
+        rebind_candidates();
+        candidates.push_back(p);
+    }
+
+    // Candidates still buffered when a thread exits are handed over to the
+    // next collection run by any thread
+    struct abandoned_candidates {
+        std::mutex mutex;
+        std::atomic<bool> any{false};
+        node_list nodes{bookkeeping_resources::instance().global.load()};
+
+        // Called with the mutex held
+        void rebind_if_empty() {
+            if (nodes.empty())
+                rebind(nodes, bookkeeping_resources::instance().global.load());
+        }
+
+        static abandoned_candidates &instance() {
+            static abandoned_candidates abandoned;
+            return abandoned;
+        }
+    };
+
+    collection_state() {
+        abandoned_candidates::instance();
+    }
+
+    ~collection_state() {
+        if (candidates.empty())
+            return;
+        auto &abandoned = abandoned_candidates::instance();
+        std::lock_guard<std::mutex> guard(abandoned.mutex);
+        abandoned.rebind_if_empty();
+        abandoned.nodes.insert(
+            abandoned.nodes.end(), candidates.begin(), candidates.end());
+        abandoned.any = true;
+    }
+
+    void adopt_abandoned() {
+        auto &abandoned = abandoned_candidates::instance();
+        if (!abandoned.any)
+            return;
+        std::lock_guard<std::mutex> guard(abandoned.mutex);
+        for (auto p : abandoned.nodes)
+            add_candidate(p);
+        abandoned.nodes.clear();
+        abandoned.rebind_if_empty();
+        abandoned.any = false;
+    }
+
+    static collection_state &instance() {
+        static thread_local collection_state state;
+        return state;
+    }
+};
+
+// What is left to do once a reference has been dropped. In thread-safe
+// mode it is decided under the header's lock, and done after releasing it
+enum class drop_action { none, check, collect, free, release };
+
+// The type an object was created as, for finding out later whether it is
+// a T. Only polymorphic objects can have a more derived type than that, and
+// for them most_derived finds the start of the complete object
+struct object_kind {
+    std::type_info const &(*dynamic_type)(void *object);
+    void *(*most_derived)(void *object);
+};
+
+template <typename T> struct object_kind_for {
+    static std::type_info const &dynamic_type(void *object) {
+        if constexpr (std::is_polymorphic<T>::value)
+            return typeid(*static_cast<T *>(object));
+        else
+            return typeid(T);
+    }
+
+    static void *most_derived(void *object) {
+        if constexpr (std::is_polymorphic<T>::value)
+            return dynamic_cast<void *>(static_cast<T *>(object));
+        else
+            return object;
+    }
+
+    static constexpr object_kind kind = {&dynamic_type, &most_derived};
+};
+
+// An object whose dynamic type is T starts with its T, so only the type
+// needs to be compared; finding a T as a base of another type would need
+// both types to be known in the same place
+template <typename T> T *object_as(object_kind const &kind, void *object) {
+    if (kind.dynamic_type(object) != typeid(T))
+        return nullptr;
+    return static_cast<T *>(kind.most_derived(object));
+}
+
+// Control blocks carry no vtable: each concrete header type registers a
+// descriptor of functions once, and the header stores its index in the
+// table of descriptors
+struct header_descriptor {
+    void (*do_delete)(root_ptr_header_block_base *);
+    internal_base *(*get_internal_base)(root_ptr_header_block_base *);
+    void *(*get_object)(root_ptr_header_block_base *, object_kind const *&);
+    void (*destroy)(root_ptr_header_block_base *);
+    // Destroys a pooled header without freeing its memory, and returns the
+    // block; returns nullptr for headers that are not pooled
+    void *(*release_block)(root_ptr_header_block_base *, slab_pool *&);
+};
+
+class header_descriptor_table {
+    static constexpr std::size_t max_descriptors = std::size_t(1) << 15;
+
+    std::mutex mutex;
+    std::uint32_t count = 1;
+    header_descriptor const *descriptors[max_descriptors] = {};
+
+    static header_descriptor_table &instance() {
+        static header_descriptor_table table;
+        return table;
+    }
+
+  public:
+    static std::uint32_t add(header_descriptor const *descriptor) {
+        auto &table = instance();
+        std::lock_guard<std::mutex> guard(table.mutex);
+        if (table.count == max_descriptors)
+            throw std::length_error("too many root_ptr header types");
+        table.descriptors[table.count] = descriptor;
+        return table.count++;
+    }
+
+    static header_descriptor const &get(std::uint32_t index) {
+        return *instance().descriptors[index];
+    }
+};
+
+template <class Header> struct header_descriptor_for;
+
+class root_ptr_header_block_base : queue_link {
+    template <class Header> friend struct header_descriptor_for;
+
+    reference_counts counts;
+    pointer_set<root_ptr_header_block_base> back_pointers;
+    internal_base *object_base;
+
+    // Trial deletion uses owned_colour as black. A proven node is tagged
+    // with the low bits of the reachability epoch, and trial_count holds
+    // the rest, as it is not needed until the node is coloured again
+    enum scan_colour {
+        no_colour = 0,
+        owned_colour = 1,
+        unreachable_colour = 2,
+        gray_colour = 3,
+        white_colour = 4,
+        claimed_colour = 5,
+        proven_colour = 6,
+        visited_colour = 7
+    };
+
+    mark_field<unsigned> trial_count;
+    // One for the node itself, until it has been destroyed, and one for
+    // each weak pointer to it; the header is freed when this reaches zero
+    weak_counter weak_count;
+    mark_field<scan_epoch> scan_mark;
+    // Both are fixed before the header is shared, so are read without a
+    // lock; the flags below them are only touched under this header's lock
+    std::uint16_t descriptor_index : 15;
+    std::uint16_t const region : 1;
+    shared_flag unreachable;
+    bool deleted : 1;
+    bool pending_collection : 1;
+    bool orphaned : 1;
+
+    static constexpr scan_epoch mark_for(scan_epoch epoch, scan_colour colour) {
+        return (epoch << colour_bits) | colour;
+    }
+
+    bool is_proven(std::uint64_t epoch) const {
+        return (scan_mark ==
+                mark_for(scan_epoch(epoch) & epoch_mask, proven_colour)) &&
+               (trial_count == unsigned(epoch >> (32 - colour_bits)));
+    }
+    bool is_proven() const {
+        return is_proven(reachability_cache::instance().epoch);
+    }
+
+    // A search tags everything it proves with the epoch it started in, so
+    // if another thread starts a new epoch meanwhile the whole path goes
+    // stale together, rather than part of it staying proven
+    void set_proven(std::uint64_t epoch) {
+        scan_mark = mark_for(scan_epoch(epoch) & epoch_mask, proven_colour);
+        trial_count = unsigned(epoch >> (32 - colour_bits));
+    }
+
+    static void prove_path(
+        scan_workspace &workspace, std::size_t index, std::uint64_t epoch);
+
+    bool has_colour(scan_epoch collection, scan_colour colour) const {
+        return scan_mark == mark_for(collection, colour);
+    }
+
+    static bool is_mark_of(scan_epoch mark, scan_epoch collection) {
+        return ((mark >> colour_bits) == collection) &&
+               ((mark & colour_mask) != no_colour) &&
+               ((mark & colour_mask) != proven_colour);
+    }
+
+    bool is_coloured(scan_epoch collection) const {
+        return is_mark_of(scan_mark, collection);
+    }
+
+    void set_colour(scan_epoch collection, scan_colour colour) {
+        scan_mark = mark_for(collection, colour);
+    }
+
+    void clear_colour() {
+        scan_mark = 0;
+    }
+
+    // Counts an edge to this node while marking in parallel, colouring the
+    // node first if no other worker has; returns true if this call made it
+    // a gray candidate. A node is briefly claimed while its trial count is
+    // set, so no edge to it is subtracted before that
+    bool count_edge_concurrently(scan_epoch collection) {
+        if (is_owned() || is_proven())
+            return false;
+        scan_epoch const claimed = mark_for(collection, claimed_colour);
+        scan_epoch mark = scan_mark.acquire();
+        while (!is_mark_of(mark, collection)) {
+            if (scan_mark.compare_exchange(mark, claimed)) {
+                trial_count = counts.internal() - 1;
+                scan_mark.release(mark_for(collection, gray_colour));
+                return true;
+            }
+        }
+        while (mark == claimed)
+            mark = scan_mark.acquire();
+        if (mark == mark_for(collection, gray_colour))
+            trial_count.atomic_decrement();
+        return false;
+    }
+
+    template <typename F> void for_each_child(F f);
+
+    void check_reachable();
+    bool reachable_from_owner();
+    static bool find_owner(
+        root_ptr_header_block_base *start, scan_workspace &workspace,
+        scan_epoch collection);
+    template <typename F> void mark_unreachable(F on_child_released);
+    void mark_unreachable() {
+        mark_unreachable([](root_ptr_header_block_base *) {});
+    }
+    static void cleanup_unreachable_nodes(
+        node_list const &nodes);
+    static void destroy_unreachable_nodes(
+        node_list const &nodes);
+    static void
+    collect_cycles(scan_workspace &workspace, scan_epoch collection);
+    static void
+    find_unreachable_children(scan_workspace &workspace, scan_epoch collection);
+    static void discover_in_parallel(
+        marking_pool &pool, scan_workspace &workspace, scan_epoch collection,
+        std::size_t first);
+    static void rescue_in_parallel(
+        marking_pool &pool, scan_workspace &workspace, scan_epoch collection);
+    static void add_unreachable_node(
+        root_ptr_header_block_base *node, scan_workspace &workspace,
+        scan_epoch collection) {
+        node->set_colour(collection, unreachable_colour);
+        workspace.unreachable_nodes.push_back(node);
+    }
+
+    header_descriptor const &descriptor() const {
+        return header_descriptor_table::get(descriptor_index);
+    }
+
+    template <typename F> void for_each_internal_base(F f);
+    // Calls f(base, object, kind) for each object with an internal_base
+    template <typename F> void for_each_object(F f);
+
+    bool is_self_edge(root_ptr_header_block_base *child) const {
+        return region && (child == this);
+    }
+
+    bool is_owned() const {
+        if (counts.owners()) {
+            return true;
+        }
+        if (counts.internal() > back_pointers.size()) {
+            return true;
+        }
+        return false;
+    }
+
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+    static constexpr unsigned nearby_parents = 8;
+
+    // True if this node is owned or proven reachable, or is held by an edge
+    // from one of its first few parents that is. A parent cannot be freed
+    // while this node's lock is held, and only its atomic fields are read
+    bool held_from_owner() const {
+        auto &cache = reachability_cache::instance();
+        if (is_owned())
+            return true;
+        if (is_proven()) {
+            ++cache.stats.hits;
+            return true;
+        }
+        unsigned checked = 0;
+        for (auto bp : back_pointers) {
+            if (bp->counts.owners())
+                return true;
+            if (bp->is_proven()) {
+                ++cache.stats.hits;
+                return true;
+            }
+            if (++checked == nearby_parents)
+                break;
+        }
+        return false;
+    }
+#endif
+
+    // Called whenever a reference to this node goes away, whether or not
+    // the count dropped
+    drop_action reference_lost() {
+        auto const owners = counts.owners();
+        auto const internal = counts.internal();
+        if (!owners && is_proven())
+            reachability_cache::instance().invalidate();
+        if (unreachable || (internal && owners))
+            return drop_action::none;
+        auto &state = collection_state::instance();
+        bool const trial_deletion = collection_config::instance().engine ==
+                                    collection_engine::trial_deletion;
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+        // The world is only stopped for a node that might be unreachable
+        if (internal && !trial_deletion && held_from_owner())
+            return drop_action::none;
+        if (!state.defer_depth && collection_queue::instance().enabled) {
+            enqueue();
+            return drop_action::none;
+        }
+#endif
+        if (state.defer_depth || (trial_deletion && internal)) {
+            add_candidate();
+            return (!state.defer_depth &&
+                    (state.candidates.size() >=
+                     collection_config::instance().candidate_buffer_size))
+                       ? drop_action::collect
+                       : drop_action::none;
+        }
+        if (!internal)
+            return trial_deletion ? drop_action::release : drop_action::free;
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+        // Another thread may free the header once its lock is released, so
+        // it stays pinned as a candidate until the check has run
+        add_candidate();
+        return drop_action::collect;
+#else
+        return drop_action::check;
+#endif
+    }
+
+    // A node is only freed or released here once it has neither owners nor
+    // edges, and owner_from_internal never revives such a node, so it is
+    // safe to use once its lock is gone
+    void complete(drop_action action) {
+        switch (action) {
+        case drop_action::none:
+            break;
+        case drop_action::check:
+            check_reachable();
+            break;
+        case drop_action::collect:
+            collect_candidates();
+            break;
+        case drop_action::free: {
+            world_guard world;
+            free_self();
+            break;
+        }
+        case drop_action::release: {
+            world_guard world;
+            release_self();
+            break;
+        }
+        }
+    }
+
+    void add_candidate() {
+        if (!pending_collection) {
+            pending_collection = true;
+            collection_state::instance().add_candidate(this);
+        }
+    }
+
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+    // The header stays pinned while it is queued, just as for a candidate
+    void enqueue() {
+        if (!pending_collection) {
+            pending_collection = true;
+            collection_queue::instance().push(this);
+        }
+    }
+
+    static void take_queued(std::size_t max_nodes, std::size_t &taken);
+#endif
+
+    void delete_object() {
+        if (!deleted) {
+            deleted = true;
+            descriptor().do_delete(this);
+        }
+    }
+
+    void free_self() {
+        if (unreachable)
+            return;
+        scan_workspace_lease workspace;
+        auto const collection = next_scan_epoch();
+        add_unreachable_node(this, *workspace, collection);
+        find_unreachable_children(*workspace, collection);
+        cleanup_unreachable_nodes(workspace->unreachable_nodes);
+    }
+
+    void release_self();
+
+    static constexpr std::size_t prefetch_distance = 8;
+
+  protected:
+    // There is no destructor to run, so the object counts as deleted from
+    // the start, and teardown never calls do_delete
+    void set_trivially_destructible() {
+        deleted = true;
+    }
+
+    void set_descriptor(std::uint32_t index) {
+        descriptor_index = static_cast<std::uint16_t>(index) & 0x7fff;
+    }
+
+    ~root_ptr_header_block_base() {}
+
+    // Defaults used by the descriptor of each header type; header types
+    // that allocate themselves differently hide these
+    template <class Header> static void destroy(Header *header) {
+        delete header;
+    }
+
+    template <class Header>
+    static void *release_block(Header *, slab_pool *&) {
+        return nullptr;
+    }
+
+  public:
+    static void collect_candidates();
+    static void finish_deferred();
+    template <typename T, typename F>
+    static bool
+    walk_reachable(root_ptr<T> const &root, traversal_order order, F visit);
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+    static std::size_t collect_queued(std::size_t max_nodes);
+#endif
+
+    void add_back_pointer(root_ptr_header_block_base *p) {
+        stripe_guard guard(this);
+        back_pointers.add(p);
+    }
+    void remove_self_reference() {
+        stripe_guard guard(this);
+        counts.remove_internal();
+    }
+    void reachable_from(internal_base *p);
+    void not_reachable_from(internal_base *p);
+    bool transfer_reference(internal_base *from, internal_base *to);
+    void transferred_reference() {
+        drop_action action;
+        {
+            stripe_guard guard(this);
+            action = reference_lost();
+        }
+        complete(action);
+    }
+    unsigned use_count() {
+        return unreachable ? 0 : counts.internal();
+    }
+
+    void destroy_header() {
+        descriptor().destroy(this);
+    }
+
+    void add_weak() {
+        ++weak_count;
+    }
+    // Returns true if the header is no longer needed
+    bool remove_weak() {
+        return !--weak_count;
+    }
+
+    explicit root_ptr_header_block_base(bool region_ = false)
+        : object_base(nullptr), trial_count(0), weak_count(1), scan_mark(0),
+          descriptor_index(0), region(region_), unreachable(false),
+          deleted(false), pending_collection(false), orphaned(false) {}
+
+    bool is_unreachable() {
+        return unreachable;
+    }
+
+    void remove_owner() {
+        if (counts.remove_shared_owner())
+            return;
+        drop_action action;
+        {
+            stripe_guard guard(this);
+            counts.remove_owner();
+            action = reference_lost();
+        }
+        complete(action);
+    }
+
+    // A node still waiting for a deferred or queued check is only revived
+    // if that check would find it reachable, so the result does not depend
+    // on when the check runs
+    bool owner_from_internal() {
+        {
+            stripe_guard guard(this);
+            if (unreachable || (!counts.owners() && !counts.internal()))
+                return false;
+            if (counts.owners() || !pending_collection) {
+                counts.add_owner();
+                return true;
+            }
+        }
+        world_guard world;
+        if (unreachable || (!counts.owners() && !counts.internal()))
+            return false;
+        if (!counts.owners() && !reachable_from_owner())
+            return false;
+        counts.add_owner();
+        return true;
+    }
+
+    void set_owner();
+
+    void add_owner() {
+        counts.add_owner();
+    }
+};
+
+// Every object managed by a root_ptr pays for a header, so its size is
+// kept in check
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+constexpr std::size_t header_size_limit = 64;
+#else
+constexpr std::size_t header_size_limit = 56;
+#endif
+static_assert(
+    sizeof(root_ptr_header_block_base) <= header_size_limit,
+    "root_ptr_header_block_base has grown");
+
+template <class P> struct root_ptr_header_block : root_ptr_header_block_base {};
+
+template <class Header> struct header_descriptor_for {
+    static void do_delete(root_ptr_header_block_base *p) {
+        static_cast<Header *>(p)->do_delete();
+    }
+
+    static internal_base *get_internal_base(root_ptr_header_block_base *p) {
+        return static_cast<Header *>(p)->get_internal_base();
+    }
+
+    static void *
+    get_object(root_ptr_header_block_base *p, object_kind const *&kind) {
+        return static_cast<Header *>(p)->get_object(kind);
+    }
+
+    static void destroy(root_ptr_header_block_base *p) {
+        Header::destroy(static_cast<Header *>(p));
+    }
+
+    static void *
+    release_block(root_ptr_header_block_base *p, slab_pool *&pool) {
+        return Header::release_block(static_cast<Header *>(p), pool);
+    }
+
+    static std::uint32_t index() {
+        static header_descriptor const descriptor = {
+            &do_delete, &get_internal_base, &get_object, &destroy,
+            &release_block};
+        static std::uint32_t const index =
+            header_descriptor_table::add(&descriptor);
+        return index;
+    }
+};
+
+// Types with an unambiguous public internal_base are converted statically;
+// dynamic_cast is only needed when the base might be in a derived class
+template <typename T,
+          bool = std::is_convertible<T *, internal_base *>::value,
+          bool = std::is_polymorphic<typename std::remove_cv<T>::type>::value>
+struct get_internal_base_helper {
+    static internal_base *get_internal_base(T *p) {
+        return p;
+    }
+};
+
+template <typename T> struct get_internal_base_helper<T, false, true> {
+    static internal_base *get_internal_base(T *p) {
+        return dynamic_cast<internal_base *>(p);
+    }
+};
+
+template <typename T> struct get_internal_base_helper<T, false, false> {
+    static internal_base *get_internal_base(T *) {
+        return nullptr;
+    }
+};
+
+template <typename T> internal_base *get_internal_base_impl(T *p) {
+    return get_internal_base_helper<T>::get_internal_base(p);
+}
+
+template <class P, class D>
+struct root_ptr_header_separate : public root_ptr_header_block<P>,
+                                  private root_ptr_deleter_base<D> {
+    P const ptr;
+
+    internal_base *get_internal_base() {
+        return get_internal_base_impl(ptr);
+    }
+
+    void *get_object(object_kind const *&kind) {
+        kind = &object_kind_for<typename std::remove_pointer<P>::type>::kind;
+        return const_cast<void *>(static_cast<void const volatile *>(ptr));
+    }
+
+    root_ptr_header_separate(P p) : ptr(p) {
+        this->set_descriptor(
+            header_descriptor_for<root_ptr_header_separate>::index());
+    }
+
+    template <typename D2>
+    root_ptr_header_separate(P p, D2 &d)
+        : root_ptr_deleter_base<D>(d), ptr(p) {
+        this->set_descriptor(
+            header_descriptor_for<root_ptr_header_separate>::index());
+    }
+
+    void do_delete() {
+        root_ptr_deleter_base<D>::do_delete(ptr);
+    }
+};
+
+template <class T>
+struct root_ptr_header_combined : public root_ptr_header_block<T *> {
+    typedef
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_type;
+    storage_type storage;
+
+    T *value() {
+        return static_cast<T *>(get_base_ptr());
+    }
+
+    void *get_base_ptr() {
+        return &storage;
+    }
+
+    internal_base *get_internal_base() {
+        return get_internal_base_impl(value());
+    }
+
+    void *get_object(object_kind const *&kind) {
+        kind = &object_kind_for<T>::kind;
+        return const_cast<void *>(static_cast<void const volatile *>(value()));
+    }
+
+    template <typename... Args> root_ptr_header_combined(Args &&... args) {
+        new (get_base_ptr()) T(static_cast<Args &&>(args)...);
+        this->set_descriptor(
+            header_descriptor_for<root_ptr_header_combined>::index());
+        if (std::is_trivially_destructible<T>::value)
+            this->set_trivially_destructible();
+    }
+
+    void do_delete() {
+        value()->~T();
+    }
+};
+
+template <class T>
+struct root_ptr_header_pooled : public root_ptr_header_combined<T> {
+    template <typename... Args>
+    root_ptr_header_pooled(Args &&... args)
+        : root_ptr_header_combined<T>(static_cast<Args &&>(args)...) {
+        this->set_descriptor(
+            header_descriptor_for<root_ptr_header_pooled>::index());
+    }
+
+    static void destroy(root_ptr_header_pooled *header) {
+        header->~root_ptr_header_pooled();
+        slab_pool::cache<root_ptr_header_pooled>().deallocate(header);
+    }
+
+    static void *
+    release_block(root_ptr_header_pooled *header, slab_pool *&pool) {
+        void *const block = header;
+        header->~root_ptr_header_pooled();
+        pool = &slab_pool::instance<root_ptr_header_pooled>();
+        return block;
+    }
+};
+
+template <class Header, class A>
+struct root_ptr_header_allocated : public Header {
+    typedef typename std::allocator_traits<A>::template rebind_alloc<
+        root_ptr_header_allocated>
+        allocator_type;
+    typedef std::allocator_traits<allocator_type> traits;
+
+    allocator_type alloc;
+
+    template <typename... Args>
+    root_ptr_header_allocated(A const &alloc_, Args &&... args)
+        : Header(static_cast<Args &&>(args)...), alloc(alloc_) {
+        this->set_descriptor(
+            header_descriptor_for<root_ptr_header_allocated>::index());
+    }
+
+    static void destroy(root_ptr_header_allocated *header) {
+        allocator_type a(header->alloc);
+        header->~root_ptr_header_allocated();
+        traits::deallocate(a, header, 1);
+    }
+
+    template <typename... Args>
+    static Header *create(A const &alloc_, Args &&... args) {
+        allocator_type a(alloc_);
+        auto const memory = traits::allocate(a, 1);
+        try {
+            return new (static_cast<void *>(memory)) root_ptr_header_allocated(
+                alloc_, static_cast<Args &&>(args)...);
+        } catch (...) {
+            traits::deallocate(a, memory, 1);
+            throw;
+        }
+    }
+};
+
+// All the objects in a region share this control block, and are carved out
+// of chunks that are only released when the whole region dies. Pointers
+// between objects in the same region are not counted.
+class region_header : public root_ptr_header_block_base {
+    struct chunk {
+        chunk *next;
+        std::size_t size;
+    };
+
+    struct entry {
+        entry *prev;
+        void (*destroy)(void *);
+        void *object;
+        internal_base *base;
+        object_kind const *kind;
+    };
+
+    std::pmr::memory_resource *const upstream;
+    std::size_t const chunk_size;
+    chunk *chunks;
+    std::uintptr_t free_begin;
+    std::uintptr_t free_end;
+    entry *last;
+
+    static std::uintptr_t align_up(std::uintptr_t p, std::size_t alignment) {
+        return (p + alignment - 1) & ~std::uintptr_t(alignment - 1);
+    }
+
+    void add_chunk(std::size_t min_size) {
+        auto const size = std::max(chunk_size, sizeof(chunk) + min_size);
+        auto const c = static_cast<chunk *>(
+            upstream->allocate(size, alignof(std::max_align_t)));
+        c->next = chunks;
+        c->size = size;
+        chunks = c;
+        free_begin = reinterpret_cast<std::uintptr_t>(c + 1);
+        free_end = reinterpret_cast<std::uintptr_t>(c) + size;
+    }
+
+    void *allocate(std::size_t size, std::size_t alignment) {
+        auto p = align_up(free_begin, alignment);
+        if (!chunks || (p > free_end) || (free_end - p < size)) {
+            add_chunk(size + alignment);
+            p = align_up(free_begin, alignment);
+        }
+        free_begin = p + size;
+        return reinterpret_cast<void *>(p);
+    }
+
+    template <typename T> static void destroy_object(void *p) {
+        static_cast<T *>(p)->~T();
+    }
+
+  public:
+    region_header(std::size_t chunk_size_, std::pmr::memory_resource *upstream_)
+        : root_ptr_header_block_base(true), upstream(upstream_),
+          chunk_size(chunk_size_), chunks(nullptr),
+          free_begin(0), free_end(0), last(nullptr) {
+        set_descriptor(header_descriptor_for<region_header>::index());
+    }
+
+    ~region_header() {
+        while (chunks) {
+            auto const c = chunks;
+            chunks = c->next;
+            upstream->deallocate(c, c->size, alignof(std::max_align_t));
+        }
+    }
+
+    // The constructor runs without the lock, since it may create pointers
+    // into the region
+    template <typename T, typename... Args> T *create(Args &&... args) {
+        entry *e;
+        void *storage;
+        {
+            stripe_guard guard(this);
+            e = static_cast<entry *>(allocate(sizeof(entry), alignof(entry)));
+            storage = allocate(sizeof(T), alignof(T));
+        }
+        auto const object = new (storage) T(static_cast<Args &&>(args)...);
+        e->destroy = std::is_trivially_destructible<T>::value
+                         ? nullptr
+                         : &destroy_object<T>;
+        e->object = const_cast<void *>(static_cast<void const volatile *>(object));
+        e->base = get_internal_base_impl(object);
+        e->kind = &object_kind_for<T>::kind;
+        stripe_guard guard(this);
+        e->prev = last;
+        last = e;
+        return object;
+    }
+
+    internal_base *get_internal_base() {
+        return nullptr;
+    }
+
+    void *get_object(object_kind const *&) {
+        return nullptr;
+    }
+
+    template <typename F> void for_each_base(F f) {
+        for (auto e = last; e; e = e->prev) {
+            if (e->base)
+                f(e->base);
+        }
+    }
+
+    template <typename F> void for_each_object(F f) {
+        for (auto e = last; e; e = e->prev) {
+            if (e->base)
+                f(e->base, e->object, *e->kind);
+        }
+    }
+
+    void do_delete() {
+        for (auto e = last; e; e = e->prev) {
+            if (e->destroy)
+                e->destroy(e->object);
+        }
+    }
+};
+
+template <typename F>
+void root_ptr_header_block_base::for_each_internal_base(F f) {
+    if (region)
+        static_cast<region_header *>(this)->for_each_base(f);
+    else if (object_base)
+        f(object_base);
+}
+
+template <typename F>
+void root_ptr_header_block_base::for_each_object(F f) {
+    if (region) {
+        static_cast<region_header *>(this)->for_each_object(f);
+    } else if (object_base) {
+        object_kind const *kind;
+        auto const object = descriptor().get_object(this, kind);
+        f(object_base, object, *kind);
+    }
+}
+
+struct internal_ptr_base {
+    internal_base *base;
+    root_ptr_header_block_base *header;
+    internal_ptr_base *next;
+    internal_ptr_base *prev;
+
+    internal_ptr_base(internal_base *base_, root_ptr_header_block_base *header_)
+        : base(base_), header(header_), next(nullptr), prev(nullptr) {}
+};
+
+// A whole array of edges, registered with the owning internal_base once
+struct internal_ptr_vector_base {
+    struct edge {
+        root_ptr_header_block_base *header;
+        void *ptr;
+    };
+
+    internal_base *const base;
+    std::vector<edge> edges;
+    internal_ptr_vector_base *next;
+    internal_ptr_vector_base *prev;
+
+    explicit internal_ptr_vector_base(internal_base *base_)
+        : base(base_), next(nullptr), prev(nullptr) {}
+};
+}
+
+template <class T> class root_ptr {
+  private:
+    T *ptr;
+    detail::root_ptr_header_block_base *header;
+
+    template <typename U> friend class root_ptr;
+    template <typename U> friend class internal_ptr;
+    template <typename U> friend class internal_ptr_vector;
+    template <typename U> friend class weak_root_ptr;
+    template <typename U> friend class weak_internal_ptr;
+    template <typename U> friend class detail::weak_ptr_base;
+    friend class internal_base;
+    friend class detail::root_ptr_header_block_base;
+
+    template <typename U, typename... Args>
+    friend root_ptr<U> make_root(Args &&... args);
+    template <typename U, typename... Args>
+    friend root_ptr<U> make_pooled_root(Args &&... args);
+    template <typename U, typename A, typename... Args>
+    friend root_ptr<U> allocate_root(A const &alloc, Args &&... args);
+    friend class root_arena;
+
+    root_ptr(detail::root_ptr_header_block_base *header_, T *ptr_)
+        : ptr(ptr_), header(header_) {
+        if (header && !header->owner_from_internal()) {
+            ptr = nullptr;
+            header = nullptr;
+        }
+    }
+
+    root_ptr(detail::root_ptr_header_combined<T> *header_)
+        : ptr(header_->value()), header(header_) {
+        header->set_owner();
+    }
+
+    void clear() {
+        header = nullptr;
+        ptr = nullptr;
+    }
+
+  public:
+    typedef T element_type;
+    constexpr root_ptr() noexcept : ptr(nullptr), header(nullptr) {}
+
+    template <class Y>
+    explicit root_ptr(Y *p) try
+        : ptr(p),
+          header(new detail::root_ptr_header_separate<Y *, void>(p)) {
+        header->set_owner();
+    } catch (...) {
+        delete p;
+    }
+
+    template <class Y, class D>
+    root_ptr(Y *p, D d) try
+        : ptr(p),
+          header(new detail::root_ptr_header_separate<Y *, D>(p, d)) {
+        header->set_owner();
+    } catch (...) {
+        d(p);
+    }
+
+    template <class D>
+    root_ptr(std::nullptr_t p, D d) try
+        : ptr(p),
+          header(
+              new detail::root_ptr_header_separate<std::nullptr_t, D>(p, d)) {
+        header->set_owner();
+    } catch (...) {
+        d(p);
+    }
+
+    template <class Y, class D, class A>
+    root_ptr(Y *p, D d, A a) try
+        : ptr(p),
+          header(detail::root_ptr_header_allocated<
+                 detail::root_ptr_header_separate<Y *, D>, A>::create(a, p,
+                                                                      d)) {
+        header->set_owner();
+    } catch (...) {
+        d(p);
+    }
+
+    template <class D, class A>
+    root_ptr(std::nullptr_t p, D d, A a) try
+        : ptr(p),
+          header(detail::root_ptr_header_allocated<
+                 detail::root_ptr_header_separate<std::nullptr_t, D>,
+                 A>::create(a, p, d)) {
+        header->set_owner();
+    } catch (...) {
+        d(p);
+    }
+
+    template <class Y>
+    root_ptr(const root_ptr<Y> &r, T *p) noexcept : ptr(p), header(r.header) {
+        if (header)
+            header->add_owner();
+    }
+
+    root_ptr(const root_ptr &r) noexcept : ptr(r.ptr), header(r.header) {
+        if (header)
+            header->add_owner();
+    }
+
+    template <class Y>
+    root_ptr(const root_ptr<Y> &r) noexcept : ptr(r.ptr), header(r.header) {
+        if (header)
+            header->add_owner();
+    }
+
+    root_ptr(root_ptr &&r) noexcept : ptr(r.ptr), header(r.header) {
+        r.clear();
+    }
+
+    template <class Y>
+    root_ptr(root_ptr<Y> &&r) noexcept : ptr(r.ptr), header(r.header) {
+        r.clear();
+    }
+
+    template <class Y> explicit root_ptr(const internal_ptr<Y> &r);
+
+    template <class Y, class D>
     root_ptr(std::unique_ptr<Y, D> &&r)
         : ptr(r.get()),
           header(
@@ -395,364 +2482,1547 @@ template <class T> class root_ptr {
         header->set_owner();
         r.release();
     }
-    constexpr root_ptr(std::nullptr_t) : root_ptr() {}
-    ~root_ptr() {
-        if (header) {
-            header->remove_owner();
+    constexpr root_ptr(std::nullptr_t) : root_ptr() {}
+    ~root_ptr() {
+        if (header) {
+            header->remove_owner();
+        }
+    }
+
+    root_ptr &operator=(const root_ptr &r) noexcept {
+        if (&r != this) {
+            root_ptr temp(r);
+            swap(temp);
+        }
+        return *this;
+    }
+    template <class Y> root_ptr &operator=(const root_ptr<Y> &r) noexcept {
+        root_ptr temp(r);
+        swap(temp);
+        return *this;
+    }
+
+    template <class Y> root_ptr &operator=(const internal_ptr<Y> &r) noexcept {
+        root_ptr temp(r);
+        swap(temp);
+        return *this;
+    }
+
+    root_ptr &operator=(root_ptr &&r) noexcept {
+        swap(r);
+        r.reset();
+        return *this;
+    }
+
+    template <class Y> root_ptr &operator=(root_ptr<Y> &&r) noexcept {
+        root_ptr temp(static_cast<root_ptr<Y> &&>(r));
+        swap(temp);
+        return *this;
+    }
+
+    template <class Y, class D> root_ptr &operator=(std::unique_ptr<Y, D> &&r) {
+        root_ptr temp(static_cast<std::unique_ptr<Y> &&>(r));
+        swap(temp);
+        return *this;
+    }
+    void swap(root_ptr &r) noexcept {
+        std::swap(ptr, r.ptr);
+        std::swap(header, r.header);
+    }
+    void reset() noexcept {
+        if (header) {
+            header->remove_owner();
+        }
+        clear();
+    }
+
+    template <class Y> void reset(Y *p) {
+        root_ptr temp(p);
+        swap(temp);
+    }
+
+    template <class Y, class D> void reset(Y *p, D d) {
+        root_ptr temp(p, d);
+        swap(temp);
+    }
+
+    T *get() const noexcept {
+        return ptr;
+    }
+
+    T &operator*() const noexcept {
+        return *ptr;
+    }
+
+    T *operator->() const noexcept {
+        return ptr;
+    }
+
+    unsigned use_count() const noexcept {
+        return header ? header->use_count() : 0;
+    }
+
+    bool unique() const noexcept {
+        return use_count() == 1;
+    }
+
+    explicit operator bool() const noexcept {
+        return ptr;
+    }
+    template <class U> bool owner_before(root_ptr<U> const &b) const;
+    template <class U> bool owner_before(internal_ptr<U> const &b) const;
+};
+
+class internal_base {
+    detail::root_ptr_header_block_base *self_header = nullptr;
+    detail::internal_ptr_base *pointers = nullptr;
+    detail::internal_ptr_vector_base *vectors = nullptr;
+
+    template <typename U> friend class internal_ptr;
+    template <typename U> friend class internal_ptr_vector;
+    template <typename U> friend class root_ptr;
+    friend class detail::root_ptr_header_block_base;
+    friend class root_arena;
+
+    // Calls f with a reference to the header of each outgoing edge
+    template <typename F> void for_each_edge(F f) {
+        for (auto p = pointers; p; p = p->next)
+            f(p->header);
+        for (auto v = vectors; v; v = v->next) {
+            for (auto &e : v->edges)
+                f(e.header);
+        }
+    }
+
+    // Pointers created by the constructor to other objects sharing the
+    // header were counted before it was known they point to themselves
+    void set_self_header(detail::root_ptr_header_block_base *header) {
+        self_header = header;
+        for_each_edge([&](detail::root_ptr_header_block_base *target) {
+            if (target == header)
+                header->remove_self_reference();
+            else if (target)
+                target->add_back_pointer(header);
+        });
+    }
+
+    void register_vector(detail::internal_ptr_vector_base *v) {
+        detail::stripe_guard guard(this);
+        v->prev = nullptr;
+        v->next = vectors;
+        if (vectors)
+            vectors->prev = v;
+        vectors = v;
+    }
+
+    void deregister_vector(detail::internal_ptr_vector_base *v) {
+        detail::stripe_guard guard(this);
+        if (v->prev)
+            v->prev->next = v->next;
+        else if (vectors == v)
+            vectors = v->next;
+        if (v->next)
+            v->next->prev = v->prev;
+    }
+
+    // Edges are published only once counted, and unpublished before the count
+    // is dropped, so a collection never sees an edge it cannot account for.
+    // The caller holds the lock for this node.
+    void register_ptr(detail::internal_ptr_base *p) {
+        p->prev = nullptr;
+        p->next = pointers;
+        if (pointers)
+            pointers->prev = p;
+        pointers = p;
+    }
+
+    void deregister_ptr(detail::internal_ptr_base *p) {
+        detail::root_ptr_header_block_base *header;
+        {
+            detail::stripe_guard guard(this);
+            if (p->prev)
+                p->prev->next = p->next;
+            else if (pointers == p)
+                pointers = p->next;
+            if (p->next)
+                p->next->prev = p->prev;
+            header = p->header;
+        }
+        if (header)
+            header->not_reachable_from(this);
+    }
+
+  public:
+    virtual ~internal_base() {}
+};
+
+namespace detail {
+// The object's internal_base is looked up once here, and cached for the
+// scans
+void root_ptr_header_block_base::set_owner() {
+    object_base = descriptor().get_internal_base(this);
+    if (object_base) {
+        object_base->set_self_header(this);
+    }
+}
+void root_ptr_header_block_base::reachable_from(internal_base *p) {
+    if (is_self_edge(p->self_header))
+        return;
+    stripe_guard guard(this);
+    counts.add_internal();
+    if (p->self_header) {
+        back_pointers.add(p->self_header);
+    }
+}
+
+// Moving an edge between two nodes that both have headers only changes
+// which node the back-pointer names, and leaves the count alone. Any other
+// move has to be counted. The caller must follow a successful transfer
+// with transferred_reference() once the pointers are consistent, since
+// the edge it took away may have been the only path to the new holder.
+bool root_ptr_header_block_base::transfer_reference(
+    internal_base *from, internal_base *to) {
+    if (!from->self_header || !to->self_header ||
+        is_self_edge(from->self_header) || is_self_edge(to->self_header))
+        return false;
+    stripe_guard guard(this);
+    back_pointers.add(to->self_header);
+    back_pointers.remove(from->self_header);
+    return true;
+}
+
+void root_ptr_header_block_base::not_reachable_from(internal_base *p) {
+    if (is_self_edge(p->self_header))
+        return;
+    drop_action action;
+    {
+        stripe_guard guard(this);
+        if (p->self_header) {
+            back_pointers.remove(p->self_header);
+        }
+        counts.remove_internal();
+        action = reference_lost();
+    }
+    complete(action);
+}
+
+void root_ptr_header_block_base::check_reachable() {
+    if (is_owned()) {
+        return;
+    }
+    if (is_proven()) {
+        ++reachability_cache::instance().stats.hits;
+        return;
+    }
+
+    scan_workspace_lease workspace;
+    auto const collection = next_scan_epoch();
+
+    if (find_owner(this, *workspace, collection))
+        return;
+    for (auto p : workspace->visited)
+        add_unreachable_node(p, *workspace, collection);
+    find_unreachable_children(*workspace, collection);
+    cleanup_unreachable_nodes(workspace->unreachable_nodes);
+}
+
+// Leaves the graph as it was, for the pending check to collect this node
+// if it is unreachable
+bool root_ptr_header_block_base::reachable_from_owner() {
+    scan_workspace_lease workspace;
+    auto const collection = next_scan_epoch();
+    if (find_owner(this, *workspace, collection))
+        return true;
+    for (auto p : workspace->visited)
+        p->clear_colour();
+    return false;
+}
+
+void root_ptr_header_block_base::prove_path(
+    scan_workspace &workspace, std::size_t index, std::uint64_t epoch) {
+    for (;;) {
+        workspace.visited[index]->set_proven(epoch);
+        if (!index)
+            break;
+        index = workspace.visited_parent[index];
+    }
+}
+
+// The nodes visited are coloured for the collection; if an owner is found
+// the path to it is proven and the rest of them are cleared again, and
+// otherwise they are all left for the caller to mark unreachable
+bool root_ptr_header_block_base::find_owner(
+    root_ptr_header_block_base *start, scan_workspace &workspace,
+    scan_epoch collection) {
+    constexpr bool breadth_first = JSS_INTERNAL_PTR_SEARCH_ORDER ==
+                                   JSS_INTERNAL_PTR_SEARCH_BREADTH_FIRST;
+    constexpr bool owners_first = JSS_INTERNAL_PTR_SEARCH_ORDER !=
+                                  JSS_INTERNAL_PTR_SEARCH_DEPTH_FIRST;
+
+    auto &cache = reachability_cache::instance();
+    ++cache.stats.searches;
+    std::uint64_t const proof_epoch = cache.epoch;
+    auto &visited = workspace.visited;
+    auto &visited_parent = workspace.visited_parent;
+    auto &pending = workspace.search_stack;
+    visited.clear();
+    visited_parent.clear();
+    pending.clear();
+    if (start->is_proven(proof_epoch)) {
+        ++cache.stats.hits;
+        return true;
+    }
+    start->set_colour(collection, visited_colour);
+    visited.push_back(start);
+    visited_parent.push_back(0);
+    pending.push_back(0);
+    std::size_t next_in_order = 0;
+
+    auto const proves_reachable = [&](root_ptr_header_block_base *bp) {
+        if (bp->is_proven(proof_epoch)) {
+            ++cache.stats.hits;
+            return true;
+        }
+        return owners_first && bp->is_owned();
+    };
+    auto const found = [&](std::size_t index) {
+        prove_path(workspace, index, proof_epoch);
+        for (auto v : visited) {
+            if (v->has_colour(collection, visited_colour))
+                v->clear_colour();
+        }
+        return true;
+    };
+
+    while (breadth_first ? (next_in_order != visited.size())
+                         : !pending.empty()) {
+        std::size_t index;
+        if (breadth_first) {
+            index = next_in_order++;
+        } else {
+            index = pending.back();
+            pending.pop_back();
+        }
+        auto const node = visited[index];
+        if (node->is_owned())
+            return found(index);
+        for (auto bp : node->back_pointers) {
+            if (bp->is_coloured(collection))
+                continue;
+            if (proves_reachable(bp)) {
+                bp->set_proven(proof_epoch);
+                return found(index);
+            }
+            bp->set_colour(collection, visited_colour);
+            visited.push_back(bp);
+            visited_parent.push_back(index);
+            if (!breadth_first)
+                pending.push_back(visited.size() - 1);
+        }
+    }
+    return false;
+}
+
+// The nodes reachable from the unreachable nodes without passing through
+// an owned node are candidates. A candidate that has more references than
+// there are edges to it from unreachable nodes and other candidates is
+// referenced from elsewhere, and so is reachable along with everything it
+// leads to; the rest of the candidates are unreachable. Each node and edge
+// is visited a bounded number of times.
+void root_ptr_header_block_base::find_unreachable_children(
+    scan_workspace &workspace, scan_epoch collection) {
+    auto &unreachable_nodes = workspace.unreachable_nodes;
+    auto &candidates = workspace.pending;
+    auto &reachable = workspace.reachable;
+    candidates.clear();
+
+    auto const count_edge = [&](root_ptr_header_block_base *child) {
+        if (child->has_colour(collection, gray_colour)) {
+            --child->trial_count;
+            return;
+        }
+        if (child->is_coloured(collection) || child->is_owned() ||
+            child->is_proven())
+            return;
+        child->set_colour(collection, gray_colour);
+        child->trial_count = child->counts.internal() - 1;
+        candidates.push_back(child);
+    };
+
+    auto const &parallel = parallel_marking::instance();
+    std::unique_lock<std::mutex> claim;
+    for (std::size_t i = 0; i != unreachable_nodes.size(); ++i)
+        unreachable_nodes[i]->for_each_child(count_edge);
+    for (std::size_t i = 0; i != candidates.size(); ++i) {
+        if (auto pool = parallel.pool_for(candidates.size() - i, claim)) {
+            discover_in_parallel(*pool, workspace, collection, i);
+            break;
+        }
+        candidates[i]->for_each_child(count_edge);
+    }
+
+    if (auto pool = parallel.pool_for(candidates.size(), claim)) {
+        rescue_in_parallel(*pool, workspace, collection);
+    } else {
+        for (auto candidate : candidates) {
+            if (!candidate->has_colour(collection, gray_colour) ||
+                !candidate->trial_count)
+                continue;
+            candidate->set_colour(collection, owned_colour);
+            reachable.push_back(candidate);
+            while (!reachable.empty()) {
+                auto node = reachable.back();
+                reachable.pop_back();
+                node->for_each_child([&](root_ptr_header_block_base *child) {
+                    if (child->has_colour(collection, gray_colour)) {
+                        child->set_colour(collection, owned_colour);
+                        reachable.push_back(child);
+                    }
+                });
+            }
+        }
+    }
+
+    for (auto candidate : candidates) {
+        if (candidate->has_colour(collection, gray_colour))
+            add_unreachable_node(candidate, workspace, collection);
+        else
+            candidate->clear_colour();
+    }
+}
+
+// Counts the edges from candidates[first, end) and from every candidate
+// found along the way, with the workers sharing out the nodes
+void root_ptr_header_block_base::discover_in_parallel(
+    marking_pool &pool, scan_workspace &workspace, scan_epoch collection,
+    std::size_t first) {
+    auto &candidates = workspace.pending;
+    pool.traverse(
+        candidates, first,
+        [&](unsigned index, root_ptr_header_block_base *node, auto push) {
+            node->for_each_child([&](root_ptr_header_block_base *child) {
+                if (child->count_edge_concurrently(collection)) {
+                    pool.found(index).push_back(child);
+                    push(child);
+                }
+            });
+        });
+    for (unsigned i = 0; i != pool.thread_count(); ++i) {
+        auto &found = pool.found(i);
+        candidates.insert(candidates.end(), found.begin(), found.end());
+    }
+    pool.trim();
+}
+
+void root_ptr_header_block_base::rescue_in_parallel(
+    marking_pool &pool, scan_workspace &workspace, scan_epoch collection) {
+    auto &reachable = workspace.reachable;
+    for (auto candidate : workspace.pending) {
+        if (candidate->has_colour(collection, gray_colour) &&
+            candidate->trial_count) {
+            candidate->set_colour(collection, owned_colour);
+            reachable.push_back(candidate);
+        }
+    }
+    scan_epoch const gray = mark_for(collection, gray_colour);
+    pool.traverse(
+        reachable, 0,
+        [&](unsigned, root_ptr_header_block_base *node, auto push) {
+            node->for_each_child([&](root_ptr_header_block_base *child) {
+                auto mark = gray;
+                if (child->scan_mark.compare_exchange(
+                        mark, mark_for(collection, owned_colour)))
+                    push(child);
+            });
+        });
+    reachable.clear();
+    pool.trim();
+}
+
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+// Moves queued headers to this thread's candidates; they are already
+// marked as pending
+void root_ptr_header_block_base::take_queued(
+    std::size_t max_nodes, std::size_t &taken) {
+    auto &queue = collection_queue::instance();
+    auto &state = collection_state::instance();
+    std::lock_guard<std::mutex> guard(queue.consumer_mutex);
+    state.rebind_candidates();
+    while (taken != max_nodes) {
+        auto const node = queue.pop();
+        if (!node)
+            break;
+        state.candidates.push_back(
+            static_cast<root_ptr_header_block_base *>(node));
+        ++queue.in_flight;
+        ++taken;
+    }
+}
+
+std::size_t
+root_ptr_header_block_base::collect_queued(std::size_t max_nodes) {
+    auto &queue = collection_queue::instance();
+    std::size_t taken = 0;
+    if (queue.size)
+        take_queued(max_nodes, taken);
+    collect_candidates();
+    queue.finished(taken);
+    return taken;
+}
+#endif
+
+// In queued mode the candidates of a deferred collection are handed to the
+// collector rather than checked on this thread
+void root_ptr_header_block_base::finish_deferred() {
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+    auto &queue = collection_queue::instance();
+    if (queue.enabled) {
+        auto &state = collection_state::instance();
+        for (auto p : state.candidates)
+            queue.push(p);
+        state.candidates.clear();
+        return;
+    }
+#endif
+    collect_candidates();
+}
+
+void root_ptr_header_block_base::collect_candidates() {
+    auto &state = collection_state::instance();
+    state.adopt_abandoned();
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+    // Headers queued just as queued mode was switched off are picked up by
+    // the next collection on any thread
+    auto &queue = collection_queue::instance();
+    std::size_t taken = 0;
+    if (!queue.enabled && queue.size)
+        take_queued(std::size_t(-1), taken);
+#endif
+    // Anything taken from the queue is a candidate, so nothing was taken
+    // if this returns early
+    if (state.candidates.empty())
+        return;
+    world_guard world;
+    while (!state.candidates.empty()) {
+        scan_workspace_lease workspace;
+        auto &batch = workspace->candidates;
+        batch.assign(state.candidates.begin(), state.candidates.end());
+        state.candidates.clear();
+        auto const collection = next_scan_epoch();
+
+        for (auto p : batch)
+            p->pending_collection = false;
+
+        if (collection_config::instance().engine ==
+            collection_engine::trial_deletion) {
+            collect_cycles(*workspace, collection);
+            cleanup_unreachable_nodes(workspace->unreachable_nodes);
+            continue;
+        }
+
+        for (auto p : batch) {
+            if (p->unreachable) {
+                if (p->orphaned && p->remove_weak())
+                    p->destroy_header();
+                continue;
+            }
+            if (p->is_coloured(collection))
+                continue;
+            if (!p->counts.internal()) {
+                add_unreachable_node(p, *workspace, collection);
+                continue;
+            }
+            if (p->is_owned() || find_owner(p, *workspace, collection))
+                continue;
+            for (auto v : workspace->visited) {
+                if (!v->has_colour(collection, unreachable_colour))
+                    add_unreachable_node(v, *workspace, collection);
+            }
+        }
+
+        find_unreachable_children(*workspace, collection);
+        cleanup_unreachable_nodes(workspace->unreachable_nodes);
+    }
+    state.rebind_candidates();
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+    queue.finished(taken);
+#endif
+}
+
+void root_ptr_header_block_base::collect_cycles(
+    scan_workspace &workspace, scan_epoch collection) {
+    auto &roots = workspace.visited;
+    auto &pending = workspace.pending;
+    auto &reachable = workspace.reachable;
+    auto &marked = workspace.marked;
+    roots.clear();
+    marked.clear();
+    for (auto p : workspace.candidates) {
+        if (p->unreachable) {
+            if (p->orphaned && p->remove_weak())
+                p->destroy_header();
+        } else if (!p->counts.owners()) {
+            roots.push_back(p);
+        }
+    }
+
+    for (auto r : roots) {
+        if (r->is_coloured(collection))
+            continue;
+        r->set_colour(collection, gray_colour);
+        r->trial_count = r->counts.internal();
+        marked.push_back(r);
+        pending.push_back(r);
+        while (!pending.empty()) {
+            auto node = pending.back();
+            pending.pop_back();
+            node->for_each_child([&](root_ptr_header_block_base *child) {
+                if (!child->is_coloured(collection)) {
+                    child->set_colour(collection, gray_colour);
+                    child->trial_count = child->counts.internal();
+                    marked.push_back(child);
+                    pending.push_back(child);
+                }
+                --child->trial_count;
+            });
+        }
+    }
+
+    pending.assign(roots.begin(), roots.end());
+    while (!pending.empty()) {
+        auto node = pending.back();
+        pending.pop_back();
+        if (!node->has_colour(collection, gray_colour))
+            continue;
+        if (!node->trial_count) {
+            node->set_colour(collection, white_colour);
+            node->for_each_child([&](root_ptr_header_block_base *child) {
+                pending.push_back(child);
+            });
+            continue;
+        }
+        node->set_colour(collection, owned_colour);
+        reachable.push_back(node);
+        while (!reachable.empty()) {
+            auto black = reachable.back();
+            reachable.pop_back();
+            black->for_each_child([&](root_ptr_header_block_base *child) {
+                ++child->trial_count;
+                if (!child->has_colour(collection, owned_colour)) {
+                    child->set_colour(collection, owned_colour);
+                    reachable.push_back(child);
+                }
+            });
+        }
+    }
+
+    pending.assign(roots.begin(), roots.end());
+    while (!pending.empty()) {
+        auto node = pending.back();
+        pending.pop_back();
+        if (node->has_colour(collection, white_colour)) {
+            add_unreachable_node(node, workspace, collection);
+            node->for_each_child([&](root_ptr_header_block_base *child) {
+                pending.push_back(child);
+            });
         }
     }
 
-    root_ptr &operator=(const root_ptr &r) noexcept {
-        if (&r != this) {
-            root_ptr temp(r);
-            swap(temp);
+    for (auto node : marked) {
+        if (!node->has_colour(collection, unreachable_colour))
+            node->clear_colour();
+    }
+}
+
+void root_ptr_header_block_base::release_self() {
+    if (unreachable)
+        return;
+    scan_workspace_lease workspace;
+    auto const collection = next_scan_epoch();
+    auto &unreachable_nodes = workspace->unreachable_nodes;
+    add_unreachable_node(this, *workspace, collection);
+    for (std::size_t i = 0; i != unreachable_nodes.size(); ++i) {
+        unreachable_nodes[i]->mark_unreachable(
+            [&](root_ptr_header_block_base *child) {
+                if (child->unreachable ||
+                    child->has_colour(collection, unreachable_colour))
+                    return;
+                if (!child->counts.internal())
+                    add_unreachable_node(child, *workspace, collection);
+                else if (!child->counts.owners())
+                    child->add_candidate();
+            });
+    }
+    destroy_unreachable_nodes(unreachable_nodes);
+}
+
+template <typename F> void root_ptr_header_block_base::for_each_child(F f) {
+    for_each_internal_base([&](internal_base *base) {
+        base->for_each_edge([&](root_ptr_header_block_base *child_node) {
+            if (child_node && !is_self_edge(child_node))
+                f(child_node);
+        });
+    });
+}
+
+// Pointers between objects in a region are left alone: they were never
+// counted, and report null once the region is marked unreachable
+template <typename F>
+void root_ptr_header_block_base::mark_unreachable(F on_child_released) {
+    unreachable = true;
+    for_each_internal_base([&](internal_base *base) {
+        base->for_each_edge([&](root_ptr_header_block_base *&child_node) {
+            if (child_node && !is_self_edge(child_node)) {
+                auto const released = child_node;
+                released->counts.remove_internal();
+                released->back_pointers.remove(this);
+                child_node = nullptr;
+                on_child_released(released);
+            }
+        });
+    });
+}
+
+void root_ptr_header_block_base::cleanup_unreachable_nodes(
+    node_list const &nodes) {
+    auto const count = nodes.size();
+    for (std::size_t i = 0; i != count; ++i) {
+        if (i + prefetch_distance < count)
+            prefetch(nodes[i + prefetch_distance]);
+        nodes[i]->mark_unreachable();
+    }
+    destroy_unreachable_nodes(nodes);
+}
+
+// Destructors may still look at the headers of other unreachable nodes, so
+// no header is released until every object has been destroyed. Headers
+// that are still pending collection or have weak pointers to them are left
+// for whoever is last to finish with them
+void root_ptr_header_block_base::destroy_unreachable_nodes(
+    node_list const &nodes) {
+    auto const count = nodes.size();
+    for (std::size_t i = 0; i != count; ++i) {
+        if (i + prefetch_distance < count)
+            prefetch(nodes[i + prefetch_distance]);
+        nodes[i]->delete_object();
+    }
+    slab_pool::release_batch batch;
+    for (std::size_t i = 0; i != count; ++i) {
+        if (i + prefetch_distance < count)
+            prefetch(nodes[i + prefetch_distance]);
+        auto const p = nodes[i];
+        if (p->pending_collection) {
+            p->orphaned = true;
+        } else if (p->remove_weak()) {
+            auto const &d = p->descriptor();
+            slab_pool *pool;
+            if (auto const block = d.release_block(p, pool))
+                batch.add(pool, block);
+            else
+                d.destroy(p);
+        }
+    }
+}
+}
+
+class deferred_collection {
+  public:
+    deferred_collection() {
+        ++detail::collection_state::instance().defer_depth;
+    }
+
+    deferred_collection(deferred_collection const &) = delete;
+    deferred_collection &operator=(deferred_collection const &) = delete;
+
+    ~deferred_collection() {
+        if (!--detail::collection_state::instance().defer_depth)
+            detail::root_ptr_header_block_base::finish_deferred();
+    }
+};
+
+template <typename T> class internal_ptr : detail::internal_ptr_base {
+    friend class internal_base;
+    template <typename U> friend class internal_ptr;
+    template <typename U> friend class internal_ptr_vector;
+    template <typename U> friend class root_ptr;
+    template <typename U> friend class weak_root_ptr;
+    template <typename U> friend class weak_internal_ptr;
+
+    T *ptr;
+
+    void clear() {
+        header = nullptr;
+        ptr = nullptr;
+    }
+
+    static void move_edge(
+        detail::root_ptr_header_block_base *target, internal_base *from,
+        internal_base *to) {
+        if (!target)
+            return;
+        if (target->transfer_reference(from, to)) {
+            target->transferred_reference();
+        } else {
+            target->reachable_from(to);
+            target->not_reachable_from(from);
+        }
+    }
+
+    void assign(detail::root_ptr_header_block_base *new_header, T *new_ptr) {
+        if (new_header)
+            new_header->reachable_from(base);
+        detail::root_ptr_header_block_base *old_header;
+        {
+            detail::stripe_guard guard(base);
+            old_header = header;
+            header = new_header;
+            ptr = new_ptr;
+        }
+        if (old_header)
+            old_header->not_reachable_from(base);
+    }
+
+    void attach() {
+        if (header) {
+            header->reachable_from(base);
         }
+        detail::stripe_guard guard(base);
+        base->register_ptr(this);
+    }
+
+  public:
+    explicit internal_ptr(internal_base *base_, root_ptr<T> const &p)
+        : detail::internal_ptr_base(base_, p.header), ptr(p.ptr) {
+        attach();
+    }
+
+    explicit internal_ptr(internal_base *base_, internal_ptr<T> const &p)
+        : detail::internal_ptr_base(base_, p.header), ptr(p.ptr) {
+        attach();
+    }
+
+    explicit internal_ptr(internal_base *base_)
+        : detail::internal_ptr_base(base_, nullptr), ptr(nullptr) {
+        attach();
+    }
+
+    internal_ptr(internal_ptr const &) = delete;
+    internal_ptr(internal_ptr &&other)
+        : detail::internal_ptr_base(other.base, other.header), ptr(other.ptr) {
+        detail::stripe_guard guard(base);
+        base->register_ptr(this);
+        other.clear();
+    }
+
+    internal_ptr &operator=(root_ptr<T> const &p) {
+        assign(p.header, p.ptr);
         return *this;
     }
-    template <class Y> root_ptr &operator=(const root_ptr<Y> &r) noexcept {
-        root_ptr temp(r);
-        swap(temp);
+
+    internal_ptr &operator=(internal_ptr const &p) {
+        if ((p.header != header) || (p.ptr != ptr))
+            assign(p.header, p.ptr);
         return *this;
     }
 
-    template <class Y> root_ptr &operator=(const internal_ptr<Y> &r) noexcept {
-        root_ptr temp(r);
-        swap(temp);
+    // Within a node the set of edges is unchanged, so nothing needs
+    // checking. Between nodes the edge taken away may have been the only
+    // path to either node, so the checks are batched until all the
+    // pointers are consistent.
+    internal_ptr &operator=(internal_ptr &&other) {
+        if (&other == this)
+            return *this;
+        detail::root_ptr_header_block_base *old_header;
+        {
+            detail::stripe_guard guard(base, other.base);
+            old_header = header;
+            header = other.header;
+            ptr = other.ptr;
+            other.clear();
+        }
+        if (other.base == base) {
+            if (old_header)
+                old_header->not_reachable_from(base);
+            return *this;
+        }
+        deferred_collection batch;
+        move_edge(header, other.base, base);
+        if (old_header)
+            old_header->not_reachable_from(base);
         return *this;
     }
 
-    root_ptr &operator=(root_ptr &&r) noexcept {
-        swap(r);
-        r.reset();
-        return *this;
-    }
+    void reset() {
+        detail::root_ptr_header_block_base *old_header;
+        {
+            detail::stripe_guard guard(base);
+            old_header = header;
+            clear();
+        }
+        if (old_header) {
+            old_header->not_reachable_from(base);
+        }
+    }
+
+    void swap(internal_ptr &other) {
+        {
+            detail::stripe_guard guard(base, other.base);
+            std::swap(header, other.header);
+            std::swap(ptr, other.ptr);
+        }
+        if (other.base == base)
+            return;
+        deferred_collection batch;
+        move_edge(header, other.base, base);
+        move_edge(other.header, base, other.base);
+    }
+
+    friend void swap(internal_ptr &lhs, internal_ptr &rhs) {
+        lhs.swap(rhs);
+    }
+
+    T *get() const noexcept {
+        return (!header || header->is_unreachable()) ? nullptr : ptr;
+    }
+
+    T &operator*() const noexcept {
+        return *get();
+    }
+
+    T *operator->() const noexcept {
+        return get();
+    }
+
+    long use_count() const noexcept {
+        return header ? header->use_count() : 0;
+    }
+
+    bool unique() const noexcept {
+        return use_count() == 1;
+    }
+
+    explicit operator bool() const noexcept {
+        return get();
+    }
+
+    ~internal_ptr() {
+        base->deregister_ptr(this);
+    }
+};
+
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+// Checks up to max_nodes of the nodes queued for collection, and returns
+// how many were taken from the queue
+inline std::size_t collect_some(std::size_t max_nodes) {
+    return detail::root_ptr_header_block_base::collect_queued(max_nodes);
+}
+
+// Returns once the queue is empty and no other thread is still checking
+// nodes it took from it. Called during a collection, it only checks what
+// it can take from the queue itself
+inline void collect() {
+    auto &queue = detail::collection_queue::instance();
+    do {
+        while (collect_some(std::size_t(-1)))
+            ;
+        if (detail::graph_locks::world_depth())
+            return;
+        queue.wait_until_idle();
+    } while (queue.size);
+}
+
+inline bool get_queued_collection() {
+    return detail::collection_queue::instance().enabled;
+}
+
+inline void set_queued_collection(bool queued) {
+    detail::collection_queue::instance().enabled = queued;
+    if (!queued)
+        collect();
+}
+
+// Runs collections from the queue on a dedicated thread for as long as it
+// exists
+class background_collector {
+    std::atomic<bool> running;
+    std::thread thread;
+
+    void run() {
+        auto &queue = detail::collection_queue::instance();
+        while (running) {
+            if (collect_some(batch_size))
+                continue;
+            std::unique_lock<std::mutex> lock(queue.wake_mutex);
+            queue.sleeping = true;
+            queue.wake.wait(lock, [&] { return queue.size || !running; });
+            queue.sleeping = false;
+        }
+    }
+
+  public:
+    static constexpr std::size_t batch_size = 256;
+
+    background_collector() : running(true) {
+        set_queued_collection(true);
+        thread = std::thread(&background_collector::run, this);
+    }
+
+    background_collector(background_collector const &) = delete;
+    background_collector &operator=(background_collector const &) = delete;
+
+    ~background_collector() {
+        {
+            auto &queue = detail::collection_queue::instance();
+            std::lock_guard<std::mutex> guard(queue.wake_mutex);
+            running = false;
+            queue.wake.notify_one();
+        }
+        thread.join();
+        set_queued_collection(false);
+    }
+};
+#else
+inline void collect() {
+    detail::root_ptr_header_block_base::collect_candidates();
+}
+#endif
+
+namespace detail {
+// Nodes are marked when they are taken from the list rather than when they
+// are added, so adding a child does not touch it. A breadth-first walk
+// knows which nodes it will take next, so prefetches them; a depth-first
+// walk usually takes the child it has just added, so there is nothing to
+// gain. The whole walk is one consistent view of the structure, so in
+// thread-safe mode no other thread may change it meanwhile, and references
+// dropped by the visitor are not collected until it has finished
+template <typename T, typename F>
+bool root_ptr_header_block_base::walk_reachable(
+    root_ptr<T> const &root, traversal_order order, F visit) {
+    if (!root.header)
+        return true;
+    deferred_collection batch;
+    world_guard world;
+    scan_workspace_lease workspace;
+    auto &pending = workspace->pending;
+    auto &visited = workspace->visited;
+    pending.clear();
+    visited.clear();
+    bool const breadth_first = order == traversal_order::breadth_first;
+    auto const visit_epoch = next_scan_epoch();
+    pending.push_back(root.header);
+    std::size_t next = 0;
+    bool stopped = false;
+    while (!stopped && (next != pending.size())) {
+        root_ptr_header_block_base *node;
+        if (breadth_first) {
+            if (next + prefetch_distance < pending.size())
+                prefetch(pending[next + prefetch_distance]);
+            node = pending[next++];
+        } else {
+            node = pending.back();
+            pending.pop_back();
+        }
+        if (node->has_colour(visit_epoch, visited_colour) || node->unreachable)
+            continue;
+        node->set_colour(visit_epoch, visited_colour);
+        visited.push_back(node);
+        node->for_each_object(
+            [&](internal_base *base, void *object, object_kind const &kind) {
+                if (!stopped && !visit(*base, object, kind))
+                    stopped = true;
+            });
+        if (!stopped) {
+            node->for_each_child([&](root_ptr_header_block_base *child) {
+                pending.push_back(child);
+            });
+        }
+    }
+    for (auto node : visited)
+        node->clear_colour();
+    return !stopped;
+}
+}
+
+// Calls visitor with a T& for each object whose dynamic type is T and that
+// can be reached from root by following internal_ptr<T>s, including the
+// root itself, once each; objects of other types are passed over, but still
+// followed, and with T as internal_base every object is visited. Every
+// object in an arena is visited once the arena is reached. If visitor
+// returns false, the walk stops and for_each_reachable returns false. The
+// visitor must not change the structure being walked
+template <typename T, typename Visitor>
+bool for_each_reachable(
+    root_ptr<T> const &root, Visitor visitor,
+    traversal_order order = traversal_order::depth_first) {
+    return detail::root_ptr_header_block_base::walk_reachable(
+        root, order,
+        [&](internal_base &base, void *object,
+            detail::object_kind const &kind) {
+            T *target;
+            if constexpr (std::is_same<
+                              typename std::remove_cv<T>::type,
+                              internal_base>::value)
+                target = &base;
+            else if (!(target = detail::object_as<
+                           typename std::remove_cv<T>::type>(kind, object)))
+                return true;
+            if constexpr (std::is_void<decltype(visitor(*target))>::value) {
+                visitor(*target);
+                return true;
+            } else {
+                return static_cast<bool>(visitor(*target));
+            }
+        });
+}
+
+inline void set_collection_engine(collection_engine engine) {
+    collect();
+    detail::collection_config::instance().engine = engine;
+}
+
+inline collection_engine get_collection_engine() {
+    return detail::collection_config::instance().engine;
+}
+
+inline void set_candidate_buffer_size(std::size_t size) {
+    detail::collection_config::instance().candidate_buffer_size = size;
+}
+
+// Shares the search for unreachable nodes across the given number of
+// threads, counting the one that dropped the last reference, once at least
+// threshold nodes are waiting to be examined. A thread count of zero uses
+// one thread per core, and one turns parallel marking off
+inline void
+set_parallel_marking(unsigned threads, std::size_t threshold = 1 << 16) {
+    if (!threads)
+        threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+    detail::world_guard guard;
+    auto &config = detail::parallel_marking::instance();
+    config.threshold = (std::max)(threshold, std::size_t(1));
+    if (config.pool && (config.pool->thread_count() == threads))
+        return;
+    config.pool.reset(
+        (threads > 1) ? new detail::marking_pool(threads) : nullptr);
+}
+
+inline unsigned get_parallel_marking_threads() {
+    auto const &pool = detail::parallel_marking::instance().pool;
+    return pool ? pool->thread_count() : 1;
+}
+
+inline reachability_cache_stats get_reachability_cache_stats() {
+    auto const &stats = detail::reachability_cache::instance().stats;
+    return {stats.searches, stats.hits, stats.invalidations};
+}
+
+inline void reset_reachability_cache_stats() {
+    auto &stats = detail::reachability_cache::instance().stats;
+    stats.searches = 0;
+    stats.hits = 0;
+    stats.invalidations = 0;
+}
+
+// Storage already allocated is given back to the resource it came from, so
+// the previous resource must outlive every control block whose back
+// pointers grew while it was set. The parallel marking pool gives back its
+// queues straight away; other threads give back the scan buffers they keep
+// from it when they next scan, or when they exit
+inline std::pmr::memory_resource *
+set_bookkeeping_resource(std::pmr::memory_resource *resource) {
+    auto const previous =
+        detail::bookkeeping_resources::instance().global.exchange(
+            resource ? resource : std::pmr::new_delete_resource());
+    auto &pool = detail::scan_workspace_pool::instance();
+    pool.workspaces.resize(pool.depth);
+    detail::collection_state::instance().rebind_candidates();
+    {
+        detail::world_guard guard;
+        if (auto const &marking = detail::parallel_marking::instance().pool) {
+            auto const claim = marking->claim();
+            marking->trim();
+        }
+    }
+    auto &abandoned = detail::collection_state::abandoned_candidates::instance();
+    std::lock_guard<std::mutex> guard(abandoned.mutex);
+    abandoned.rebind_if_empty();
+    return previous;
+}
+
+inline std::pmr::memory_resource *get_bookkeeping_resource() {
+    return detail::bookkeeping_resources::instance().global.load();
+}
+
+class bookkeeping_resource_scope {
+    std::pmr::memory_resource *previous;
+
+  public:
+    explicit bookkeeping_resource_scope(std::pmr::memory_resource *resource)
+        : previous(detail::bookkeeping_resources::scoped()) {
+        detail::bookkeeping_resources::scoped() = resource;
+    }
+
+    bookkeeping_resource_scope(bookkeeping_resource_scope const &) = delete;
+    bookkeeping_resource_scope &
+    operator=(bookkeeping_resource_scope const &) = delete;
+
+    ~bookkeeping_resource_scope() {
+        detail::bookkeeping_resources::scoped() = previous;
+    }
+};
+
+// Edges removed together are released inside a single deferred
+// collection, so they cost one combined reachability check
+template <typename T>
+class internal_ptr_vector : detail::internal_ptr_vector_base {
+    typedef detail::internal_ptr_vector_base::edge edge;
+
+    // The pointer is converted to T* before it is stored, as target()
+    // reads it back as one
+    template <typename P> static edge make_edge(P const &p) {
+        T *const converted = p.ptr;
+        return {p.header, converted};
+    }
+
+    static T *target(edge const &e) {
+        return (!e.header || e.header->is_unreachable())
+                   ? nullptr
+                   : static_cast<T *>(e.ptr);
+    }
+
+    // The edges are unpublished by moving each header into the edge's
+    // pointer, where collections do not look, and only erased once their
+    // counts have been dropped
+    void release(std::size_t first, std::size_t last) {
+        deferred_collection batch;
+        {
+            detail::stripe_guard guard(base);
+            for (auto i = first; i != last; ++i) {
+                edges[i].ptr = edges[i].header;
+                edges[i].header = nullptr;
+            }
+        }
+        for (auto i = first; i != last; ++i) {
+            if (auto const header =
+                    static_cast<detail::root_ptr_header_block_base *>(
+                        edges[i].ptr))
+                header->not_reachable_from(base);
+        }
+        detail::stripe_guard guard(base);
+        edges.erase(edges.begin() + first, edges.begin() + last);
+    }
+
+    template <typename P> void add(P const &p) {
+        if (p.header)
+            p.header->reachable_from(base);
+        try {
+            detail::stripe_guard guard(base);
+            edges.push_back(make_edge(p));
+        } catch (...) {
+            if (p.header)
+                p.header->not_reachable_from(base);
+            throw;
+        }
+    }
+
+  public:
+    typedef T *value_type;
+    typedef std::size_t size_type;
+
+    class const_iterator {
+        edge const *pos;
+
+        friend class internal_ptr_vector;
+
+        explicit const_iterator(edge const *pos_) : pos(pos_) {}
+
+      public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef T *value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef void pointer;
+        typedef T *reference;
+
+        T *operator*() const {
+            return target(*pos);
+        }
+
+        T *operator[](difference_type n) const {
+            return target(pos[n]);
+        }
+
+        const_iterator &operator++() {
+            ++pos;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto temp = *this;
+            ++pos;
+            return temp;
+        }
+
+        const_iterator &operator--() {
+            --pos;
+            return *this;
+        }
+
+        const_iterator operator--(int) {
+            auto temp = *this;
+            --pos;
+            return temp;
+        }
+
+        const_iterator &operator+=(difference_type n) {
+            pos += n;
+            return *this;
+        }
+
+        const_iterator &operator-=(difference_type n) {
+            pos -= n;
+            return *this;
+        }
+
+        friend const_iterator operator+(const_iterator it, difference_type n) {
+            return it += n;
+        }
+
+        friend const_iterator operator+(difference_type n, const_iterator it) {
+            return it += n;
+        }
+
+        friend const_iterator operator-(const_iterator it, difference_type n) {
+            return it -= n;
+        }
+
+        friend difference_type
+        operator-(const_iterator const &lhs, const_iterator const &rhs) {
+            return lhs.pos - rhs.pos;
+        }
+
+        friend bool
+        operator==(const_iterator const &lhs, const_iterator const &rhs) {
+            return lhs.pos == rhs.pos;
+        }
+
+        friend bool
+        operator!=(const_iterator const &lhs, const_iterator const &rhs) {
+            return lhs.pos != rhs.pos;
+        }
+
+        friend bool
+        operator<(const_iterator const &lhs, const_iterator const &rhs) {
+            return lhs.pos < rhs.pos;
+        }
+
+        friend bool
+        operator>(const_iterator const &lhs, const_iterator const &rhs) {
+            return lhs.pos > rhs.pos;
+        }
+
+        friend bool
+        operator<=(const_iterator const &lhs, const_iterator const &rhs) {
+            return lhs.pos <= rhs.pos;
+        }
+
+        friend bool
+        operator>=(const_iterator const &lhs, const_iterator const &rhs) {
+            return lhs.pos >= rhs.pos;
+        }
+    };
 
-    template <class Y> root_ptr &operator=(root_ptr<Y> &&r) noexcept {
-        root_ptr temp(static_cast<root_ptr<Y> &&>(r));
-        swap(temp);
-        return *this;
+    explicit internal_ptr_vector(internal_base *base_)
+        : detail::internal_ptr_vector_base(base_) {
+        base->register_vector(this);
     }
 
-    template <class Y, class D> root_ptr &operator=(std::unique_ptr<Y, D> &&r) {
-        root_ptr temp(static_cast<std::unique_ptr<Y> &&>(r));
-        swap(temp);
-        return *this;
-    }
-    void swap(root_ptr &r) noexcept {
-        std::swap(ptr, r.ptr);
-        std::swap(header, r.header);
-    }
-    void reset() noexcept {
-        if (header) {
-            header->remove_owner();
-        }
+    internal_ptr_vector(internal_ptr_vector const &) = delete;
+    internal_ptr_vector &operator=(internal_ptr_vector const &) = delete;
+
+    ~internal_ptr_vector() {
         clear();
+        base->deregister_vector(this);
     }
 
-    template <class Y> void reset(Y *p) {
-        root_ptr temp(p);
-        swap(temp);
+    size_type size() const noexcept {
+        return edges.size();
     }
 
-    template <class Y, class D> void reset(Y *p, D d) {
-        root_ptr temp(p, d);
-        swap(temp);
+    bool empty() const noexcept {
+        return edges.empty();
     }
 
-    T *get() const noexcept {
-        return ptr;
+    void reserve(size_type n) {
+        detail::stripe_guard guard(base);
+        edges.reserve(n);
     }
 
-    T &operator*() const noexcept {
-        return *ptr;
+    T *operator[](size_type i) const noexcept {
+        return target(edges[i]);
     }
 
-    T *operator->() const noexcept {
-        return ptr;
+    const_iterator begin() const noexcept {
+        return const_iterator(edges.data());
     }
 
-    unsigned use_count() const noexcept {
-        return header ? header->use_count() : 0;
+    const_iterator end() const noexcept {
+        return const_iterator(edges.data() + edges.size());
     }
 
-    bool unique() const noexcept {
-        return use_count() == 1;
+    void push_back(root_ptr<T> const &p) {
+        add(p);
     }
 
-    explicit operator bool() const noexcept {
-        return ptr;
+    void push_back(internal_ptr<T> const &p) {
+        add(p);
     }
-    template <class U> bool owner_before(root_ptr<U> const &b) const;
-    template <class U> bool owner_before(internal_ptr<U> const &b) const;
-};
-
-class internal_base {
-    detail::root_ptr_header_block_base *self_header = nullptr;
-    detail::internal_ptr_base *pointers = nullptr;
-
-    template <typename U> friend class internal_ptr;
-    template <typename U> friend class root_ptr;
-    friend class detail::root_ptr_header_block_base;
 
-    void set_self_header(detail::root_ptr_header_block_base *header) {
-        self_header = header;
-        for (auto p = pointers; p; p = p->next) {
-            if (p->header)
-                p->header->add_back_pointer(header);
-        }
+    template <typename U> void push_back(root_ptr<U> const &p) {
+        add(p);
     }
 
-    void register_ptr(detail::internal_ptr_base *p) {
-        p->next = pointers;
-        pointers = p;
+    template <typename U> void push_back(internal_ptr<U> const &p) {
+        add(p);
     }
 
-    void deregister_ptr(detail::internal_ptr_base *p) {
-        detail::internal_ptr_base **entry = &pointers;
-        while (*entry && (*entry != p))
-            entry = &((*entry)->next);
-        if (*entry == p)
-            *entry = p->next;
-        if (p->header)
-            p->header->not_reachable_from(this);
+    const_iterator erase(const_iterator pos) {
+        return erase(pos, pos + 1);
     }
 
-  public:
-    virtual ~internal_base() {}
-};
-
-namespace detail {
-void root_ptr_header_block_base::set_owner() {
-    if (auto target = get_internal_base()) {
-        target->set_self_header(this);
-    }
-}
-void root_ptr_header_block_base::reachable_from(internal_base *p) {
-    ++internal_count;
-    if (p->self_header) {
-        back_pointers.add(p->self_header);
+    const_iterator erase(const_iterator first, const_iterator last) {
+        auto const index = first - begin();
+        release(index, last - begin());
+        return begin() + index;
     }
-}
 
-void root_ptr_header_block_base::not_reachable_from(internal_base *p) {
-    if (p->self_header) {
-        back_pointers.remove(p->self_header);
+    void pop_back() {
+        release(edges.size() - 1, edges.size());
     }
-    dec_internal_count();
-}
 
-void root_ptr_header_block_base::check_reachable() {
-    if (is_owned()) {
-        return;
+    void clear() {
+        release(0, edges.size());
     }
 
-    pointer_set<root_ptr_header_block_base> seen;
-    std::vector<root_ptr_header_block_base *> pending(1, this);
-    seen.add(this);
-
-    if (check_reachable(seen, pending))
-        return;
-    find_unreachable_children(seen, pending);
-    cleanup_unreachable_nodes(seen);
-}
-
-bool root_ptr_header_block_base::check_reachable(
-    pointer_set<root_ptr_header_block_base> &seen_parents,
-    std::vector<root_ptr_header_block_base *> &pending,
-    pointer_set<root_ptr_header_block_base> *unreachable_nodes,
-    pointer_set<root_ptr_header_block_base> *owned_nodes) {
-    while (!pending.empty()) {
-        auto node = pending.back();
-        pending.pop_back();
-        if (owned_nodes && owned_nodes->contains(node))
-            return true;
-        if (unreachable_nodes && unreachable_nodes->contains(node))
-            continue;
-
-        if (!node->is_owned()) {
-            for (auto bp : node->back_pointers) {
-                if ((unreachable_nodes && unreachable_nodes->contains(bp)) ||
-                    seen_parents.contains(bp))
-                    continue;
-                if (owned_nodes && owned_nodes->contains(bp)) {
-                    owned_nodes->add_unique(node);
-                    return true;
-                }
-                seen_parents.add(bp);
-                pending.push_back(bp);
-            }
-        } else {
-            if (owned_nodes)
-                owned_nodes->add_unique(node);
-            return true;
+    // The new edges are counted before the old ones are released, so
+    // targets that appear in both are never considered for collection
+    template <typename InputIterator>
+    void assign(InputIterator first, InputIterator last) {
+        std::vector<edge> new_edges;
+        for (; first != last; ++first)
+            new_edges.push_back(make_edge(*first));
+        {
+            detail::stripe_guard guard(base);
+            edges.reserve(edges.size() + new_edges.size());
+        }
+        for (auto const &e : new_edges) {
+            if (e.header)
+                e.header->reachable_from(base);
         }
+        std::size_t old_size;
+        {
+            detail::stripe_guard guard(base);
+            old_size = edges.size();
+            edges.insert(edges.begin(), new_edges.begin(), new_edges.end());
+        }
+        release(new_edges.size(), new_edges.size() + old_size);
     }
-    return false;
-}
+};
 
-void root_ptr_header_block_base::find_unreachable_children(
-    pointer_set<root_ptr_header_block_base> &unreachable_nodes,
-    std::vector<root_ptr_header_block_base *> &nodes_to_check_children) {
-
-    pointer_set<root_ptr_header_block_base> owned_nodes;
-    nodes_to_check_children.assign(
-        unreachable_nodes.begin(), unreachable_nodes.end());
-    pointer_set<root_ptr_header_block_base> seen_parents;
-
-    std::vector<root_ptr_header_block_base *> pending;
-
-    while (!nodes_to_check_children.empty()) {
-        auto next = nodes_to_check_children.back();
-        nodes_to_check_children.pop_back();
-
-        if (auto base = next->get_internal_base()) {
-            auto child = base->pointers;
-            while (child) {
-                auto const child_node = child->header;
-                child = child->next;
-                if (child_node) {
-                    if (unreachable_nodes.contains(child_node) ||
-                        owned_nodes.contains(child_node)) {
-                        continue;
-                    }
+class root_arena {
+    detail::region_header *header;
 
-                    if (child_node->is_owned()) {
-                        owned_nodes.add(child_node);
-                        continue;
-                    }
+  public:
+    explicit root_arena(
+        std::size_t chunk_size = 4096,
+        std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+        : header(new detail::region_header(chunk_size, upstream)) {}
 
-                    pending.clear();
-                    seen_parents.clear();
-                    pending.push_back(child_node);
-
-                    if (!check_reachable(
-                            seen_parents, pending, &unreachable_nodes,
-                            &owned_nodes)) {
-                        for (auto p : seen_parents) {
-                            if (unreachable_nodes.add_unique(p))
-                                nodes_to_check_children.push_back(p);
-                        }
-                        if (unreachable_nodes.add_unique(child_node))
-                            nodes_to_check_children.push_back(child_node);
-                    } else {
-                        owned_nodes.add_unique(child_node);
-                    }
-                }
-            }
-        }
-    }
-}
-void root_ptr_header_block_base::mark_unreachable() {
-    unreachable = true;
-    if (auto base = get_internal_base()) {
-        auto child = base->pointers;
-        while (child) {
-            if (auto const child_node = child->header) {
-                --child_node->internal_count;
-                child_node->back_pointers.remove(this);
-                child->header = nullptr;
-            }
-            child = child->next;
-        }
-    }
-}
+    root_arena(root_arena const &) = delete;
+    root_arena &operator=(root_arena const &) = delete;
 
-void root_ptr_header_block_base::cleanup_unreachable_nodes(
-    pointer_set<root_ptr_header_block_base> const &seen) {
-    for (auto p : seen) {
-        p->mark_unreachable();
-    }
-    for (auto p : seen) {
-        p->delete_object();
-    }
-    for (auto p : seen) {
-        delete p;
+    ~root_arena() {
+        header->remove_owner();
     }
-}
-}
 
-template <typename T> class internal_ptr : detail::internal_ptr_base {
-    friend class internal_base;
-    template <typename U> friend class internal_ptr;
-    template <typename U> friend class root_ptr;
+    template <typename T, typename... Args>
+    root_ptr<T> make_root(Args &&... args) {
+        auto const object =
+            header->create<T>(static_cast<Args &&>(args)...);
+        detail::root_ptr_header_block_base *const block = header;
+        if (auto base = detail::get_internal_base_impl(object))
+            base->set_self_header(block);
+        return root_ptr<T>(block, object);
+    }
+};
 
+template <typename T> class local_ptr {
     T *ptr;
 
-    void clear() {
-        header = nullptr;
-        ptr = nullptr;
-    }
-
   public:
-    explicit internal_ptr(internal_base *base_, root_ptr<T> const &p)
-        : detail::internal_ptr_base(base_, p.header), ptr(p.ptr) {
-        base->register_ptr(this);
-        if (header) {
-            header->reachable_from(base);
-        }
+    local_ptr(root_ptr<T> const &other) noexcept : ptr(other.get()) {}
+    local_ptr(root_ptr<T> const &&other) = delete;
+    local_ptr(internal_ptr<T> const &other) noexcept : ptr(other.get()) {}
+    local_ptr(std::nullptr_t) noexcept : ptr(nullptr) {}
+    T *operator->() const noexcept {
+        return get();
+    }
+    T *get() const noexcept {
+        return ptr;
     }
 
-    explicit internal_ptr(internal_base *base_, internal_ptr<T> const &p)
-        : detail::internal_ptr_base(base_, p.header), ptr(p.ptr) {
-        base->register_ptr(this);
-        if (header) {
-            header->reachable_from(base);
-        }
+    T &operator*() const noexcept {
+        return *get();
     }
 
-    explicit internal_ptr(internal_base *base_)
-        : detail::internal_ptr_base(base_, nullptr), ptr(nullptr) {
-        base->register_ptr(this);
+    explicit operator bool() const noexcept {
+        return get();
     }
 
-    internal_ptr(internal_ptr const &) = delete;
-    internal_ptr(internal_ptr &&other)
-        : detail::internal_ptr_base(other.base, other.header), ptr(other.ptr) {
-        base->register_ptr(this);
-        other.ptr = nullptr;
-        other.header = nullptr;
+    void reset() noexcept {
+        ptr = nullptr;
     }
+};
 
-    internal_ptr &operator=(root_ptr<T> const &p) {
-        reset();
-        ptr = p.ptr;
-        header = p.header;
-        if (header) {
-            header->reachable_from(base);
-        }
-        return *this;
+namespace detail {
+// Keeps the header of the target alive, but adds neither an owner nor an
+// edge, so it is never followed when checking reachability
+template <typename T> class weak_ptr_base {
+  protected:
+    root_ptr_header_block_base *header;
+    T *ptr;
+
+    weak_ptr_base() noexcept : header(nullptr), ptr(nullptr) {}
+
+    weak_ptr_base(root_ptr_header_block_base *header_, T *ptr_) noexcept
+        : header(ptr_ ? header_ : nullptr), ptr(header ? ptr_ : nullptr) {
+        if (header)
+            header->add_weak();
     }
 
-    internal_ptr &operator=(internal_ptr const &p) {
-        if ((p.header != header) || (p.ptr != ptr)) {
-            auto temp_header = header;
-            header = p.header;
-            ptr = p.ptr;
-            if (header) {
-                header->reachable_from(base);
-            }
+    weak_ptr_base(weak_ptr_base const &other) noexcept
+        : weak_ptr_base(other.header, other.ptr) {}
 
-            if (temp_header)
-                temp_header->not_reachable_from(base);
-        }
+    weak_ptr_base(weak_ptr_base &&other) noexcept
+        : header(other.header), ptr(other.ptr) {
+        other.header = nullptr;
+        other.ptr = nullptr;
+    }
 
-        return *this;
+    ~weak_ptr_base() {
+        if (header && header->remove_weak())
+            header->destroy_header();
     }
 
-    void reset() {
-        if (header) {
-            header->not_reachable_from(base);
-        }
-        clear();
+    void assign(root_ptr_header_block_base *new_header, T *new_ptr) noexcept {
+        weak_ptr_base temp(new_header, new_ptr);
+        swap(temp);
     }
 
-    void swap(internal_ptr &other) {
-        jss::root_ptr<T> temp(other);
-        jss::root_ptr<T> temp2(*this);
-        other = temp2;
-        *this = temp;
+    void swap(weak_ptr_base &other) noexcept {
+        std::swap(header, other.header);
+        std::swap(ptr, other.ptr);
     }
 
+  public:
     T *get() const noexcept {
         return (!header || header->is_unreachable()) ? nullptr : ptr;
     }
@@ -765,48 +4035,100 @@ template <typename T> class internal_ptr : detail::internal_ptr_base {
         return get();
     }
 
-    long use_count() const noexcept {
-        return header ? header->use_count() : 0;
+    explicit operator bool() const noexcept {
+        return get();
     }
 
-    bool unique() const noexcept {
-        return use_count() == 1;
+    bool expired() const noexcept {
+        return !get();
     }
 
-    explicit operator bool() const noexcept {
-        return get();
+    // Returns an owner of the target, or an empty root_ptr if the target
+    // has already been found to be unreachable
+    root_ptr<T> lock() const noexcept {
+        return header ? root_ptr<T>(header, ptr) : root_ptr<T>();
     }
 
-    ~internal_ptr() {
-        base->deregister_ptr(this);
+    void reset() noexcept {
+        weak_ptr_base temp;
+        swap(temp);
     }
 };
+}
 
-template <typename T> class local_ptr {
-    T *ptr;
+// A weak_root_ptr<T> observes a node without keeping it alive
+template <typename T> class weak_root_ptr : public detail::weak_ptr_base<T> {
+    template <typename U> friend class weak_internal_ptr;
 
   public:
-    local_ptr(root_ptr<T> const &other) noexcept : ptr(other.get()) {}
-    local_ptr(root_ptr<T> const &&other) = delete;
-    local_ptr(internal_ptr<T> const &other) noexcept : ptr(other.get()) {}
-    local_ptr(std::nullptr_t) noexcept : ptr(nullptr) {}
-    T *operator->() const noexcept {
-        return get();
+    constexpr weak_root_ptr() noexcept {}
+
+    weak_root_ptr(root_ptr<T> const &p) noexcept
+        : detail::weak_ptr_base<T>(p.header, p.get()) {}
+
+    weak_root_ptr(internal_ptr<T> const &p) noexcept
+        : detail::weak_ptr_base<T>(p.header, p.get()) {}
+
+    weak_root_ptr(weak_internal_ptr<T> const &p) noexcept
+        : detail::weak_ptr_base<T>(p.header, p.get()) {}
+
+    weak_root_ptr(weak_root_ptr const &) noexcept = default;
+    weak_root_ptr(weak_root_ptr &&) noexcept = default;
+
+    weak_root_ptr &operator=(weak_root_ptr const &p) noexcept {
+        this->assign(p.header, p.ptr);
+        return *this;
     }
-    T *get() const noexcept {
-        return ptr;
+
+    weak_root_ptr &operator=(weak_root_ptr &&p) noexcept {
+        weak_root_ptr temp(static_cast<weak_root_ptr &&>(p));
+        this->swap(temp);
+        return *this;
     }
 
-    T &operator*() const noexcept {
-        return *get();
+    void swap(weak_root_ptr &other) noexcept {
+        detail::weak_ptr_base<T>::swap(other);
     }
+};
 
-    explicit operator bool() const noexcept {
-        return get();
+// A weak_internal_ptr<T> takes the place of an internal_ptr<T> for an edge,
+// such as a link back to a parent, that should not count towards the
+// reachability of its target. It is constructed with the owning node like
+// an internal_ptr<T>, but is not registered with it
+template <typename T>
+class weak_internal_ptr : public detail::weak_ptr_base<T> {
+    template <typename U> friend class weak_root_ptr;
+
+  public:
+    explicit weak_internal_ptr(internal_base *) noexcept {}
+
+    weak_internal_ptr(internal_base *, root_ptr<T> const &p) noexcept
+        : detail::weak_ptr_base<T>(p.header, p.get()) {}
+
+    weak_internal_ptr(internal_base *, internal_ptr<T> const &p) noexcept
+        : detail::weak_ptr_base<T>(p.header, p.get()) {}
+
+    weak_internal_ptr(weak_internal_ptr const &) = delete;
+    weak_internal_ptr(weak_internal_ptr &&) noexcept = default;
+
+    weak_internal_ptr &operator=(root_ptr<T> const &p) noexcept {
+        this->assign(p.header, p.get());
+        return *this;
     }
 
-    void reset() noexcept {
-        ptr = nullptr;
+    weak_internal_ptr &operator=(internal_ptr<T> const &p) noexcept {
+        this->assign(p.header, p.get());
+        return *this;
+    }
+
+    weak_internal_ptr &operator=(weak_internal_ptr const &p) noexcept {
+        this->assign(p.header, p.get());
+        return *this;
+    }
+
+    weak_internal_ptr &operator=(weak_root_ptr<T> const &p) noexcept {
+        this->assign(p.header, p.get());
+        return *this;
     }
 };
 
@@ -1028,6 +4350,35 @@ root_ptr<Target> make_root(Args &&... args) {
         new detail::root_ptr_header_combined<Target>(
             static_cast<Args &&>(args)...));
 }
+
+template <typename Target, typename... Args>
+root_ptr<Target> make_pooled_root(Args &&... args) {
+    typedef detail::root_ptr_header_pooled<Target> header_type;
+    auto &cache = detail::slab_pool::cache<header_type>();
+    void *const memory = cache.allocate();
+    try {
+        detail::root_ptr_header_combined<Target> *const header =
+            new (memory) header_type(static_cast<Args &&>(args)...);
+        return root_ptr<Target>(header);
+    } catch (...) {
+        cache.deallocate(memory);
+        throw;
+    }
+}
+
+template <typename Target, typename A, typename... Args>
+root_ptr<Target> allocate_root(A const &alloc, Args &&... args) {
+    return root_ptr<Target>(
+        detail::root_ptr_header_allocated<
+            detail::root_ptr_header_combined<Target>,
+            A>::create(alloc, static_cast<Args &&>(args)...));
+}
+
+template <typename Target> root_pool_stats get_root_pool_stats() {
+    return detail::slab_pool::instance<
+               detail::root_ptr_header_pooled<Target>>()
+        .stats();
+}
 }
 
 #endif
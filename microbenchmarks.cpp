@@ -0,0 +1,715 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include "internal_ptr.hpp"
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+
+// Every allocation records its size in a prefix before the memory handed
+// out, so the live and peak heap usage can be tracked. For over-aligned
+// allocations the prefix is padded out to the alignment
+namespace {
+std::atomic<std::size_t> live_bytes{0};
+std::atomic<std::size_t> peak_bytes{0};
+constexpr std::size_t size_prefix = alignof(std::max_align_t);
+
+std::size_t prefix_for(std::size_t alignment) {
+    return (std::max)(alignment, size_prefix);
+}
+
+void *counted_allocate(std::size_t size, std::size_t alignment = size_prefix) {
+    auto const prefix = prefix_for(alignment);
+    auto const total = size + prefix;
+    auto const block = static_cast<char *>(
+        (alignment <= size_prefix)
+            ? std::malloc(total)
+            : std::aligned_alloc(
+                  alignment, (total + alignment - 1) / alignment * alignment));
+    if (!block)
+        throw std::bad_alloc();
+    *reinterpret_cast<std::size_t *>(block) = size;
+    auto const live =
+        live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    auto peak = peak_bytes.load(std::memory_order_relaxed);
+    while ((live > peak) &&
+           !peak_bytes.compare_exchange_weak(
+               peak, live, std::memory_order_relaxed)) {
+    }
+    return block + prefix;
+}
+
+void counted_free(void *p, std::size_t alignment = size_prefix) noexcept {
+    if (!p)
+        return;
+    auto const block = static_cast<char *>(p) - prefix_for(alignment);
+    live_bytes.fetch_sub(
+        *reinterpret_cast<std::size_t *>(block), std::memory_order_relaxed);
+    std::free(block);
+}
+}
+
+void *operator new(std::size_t size) {
+    return counted_allocate(size);
+}
+void *operator new[](std::size_t size) {
+    return counted_allocate(size);
+}
+void *operator new(std::size_t size, std::nothrow_t const &) noexcept {
+    try {
+        return counted_allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void *operator new[](std::size_t size, std::nothrow_t const &) noexcept {
+    try {
+        return counted_allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void operator delete(void *p) noexcept {
+    counted_free(p);
+}
+void operator delete[](void *p) noexcept {
+    counted_free(p);
+}
+void operator delete(void *p, std::size_t) noexcept {
+    counted_free(p);
+}
+void operator delete[](void *p, std::size_t) noexcept {
+    counted_free(p);
+}
+void operator delete(void *p, std::nothrow_t const &) noexcept {
+    counted_free(p);
+}
+void operator delete[](void *p, std::nothrow_t const &) noexcept {
+    counted_free(p);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    return counted_allocate(size, static_cast<std::size_t>(alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+    return counted_allocate(size, static_cast<std::size_t>(alignment));
+}
+void *operator new(
+    std::size_t size, std::align_val_t alignment,
+    std::nothrow_t const &) noexcept {
+    try {
+        return counted_allocate(size, static_cast<std::size_t>(alignment));
+    } catch (...) {
+        return nullptr;
+    }
+}
+void *operator new[](
+    std::size_t size, std::align_val_t alignment,
+    std::nothrow_t const &) noexcept {
+    try {
+        return counted_allocate(size, static_cast<std::size_t>(alignment));
+    } catch (...) {
+        return nullptr;
+    }
+}
+void operator delete(void *p, std::align_val_t alignment) noexcept {
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+void operator delete[](void *p, std::align_val_t alignment) noexcept {
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+void operator delete(
+    void *p, std::size_t, std::align_val_t alignment) noexcept {
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+void operator delete[](
+    void *p, std::size_t, std::align_val_t alignment) noexcept {
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+void operator delete(
+    void *p, std::align_val_t alignment, std::nothrow_t const &) noexcept {
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+void operator delete[](
+    void *p, std::align_val_t alignment, std::nothrow_t const &) noexcept {
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+
+// The heap used while building a structure, per node, less whatever was
+// already allocated when the probe was created
+class memory_probe {
+    std::size_t const start;
+
+  public:
+    memory_probe() : start(live_bytes.load()) {
+        peak_bytes = start;
+    }
+
+    double per_node(std::size_t nodes) const {
+        return double(peak_bytes.load() - start) / nodes;
+    }
+};
+
+// Stops the compiler from optimizing away operations whose only effect is
+// on the value passed
+template <typename T> void keep(T const &value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r"(&value) : "memory");
+#else
+    (void)value;
+#endif
+}
+
+unsigned const node_count = 1 << 16;
+unsigned const cheap_batch = 16;
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+struct measurement {
+    std::size_t count = 0;
+    double seconds = 0;
+    // Operations timed together; the percentiles are of the mean time per
+    // operation in each batch, so with batches of more than one operation
+    // they are not the latency of a single operation
+    std::size_t batch = 0;
+    // Mean nanoseconds per operation for each batch
+    std::vector<double> samples;
+};
+
+// Runs op(i) for each i in [0, count), timing batches of batch_size
+// operations. Operations that may scan are timed one at a time
+template <typename Op>
+measurement measure(std::size_t count, std::size_t batch_size, Op op) {
+    measurement result;
+    result.count = count;
+    result.batch = batch_size;
+    result.samples.reserve(count / batch_size + 1);
+    auto const start = benchmark_clock::now();
+    for (std::size_t i = 0; i < count; i += batch_size) {
+        auto const end = std::min(count, i + batch_size);
+        auto const batch_start = benchmark_clock::now();
+        for (auto j = i; j != end; ++j)
+            op(j);
+        std::chrono::duration<double, std::nano> const elapsed =
+            benchmark_clock::now() - batch_start;
+        result.samples.push_back(elapsed.count() / (end - i));
+    }
+    result.seconds =
+        std::chrono::duration<double>(benchmark_clock::now() - start).count();
+    return result;
+}
+
+// A single operation on a whole structure, such as dropping it, reported
+// per node
+template <typename Op> measurement measure_whole(std::size_t nodes, Op op) {
+    measurement result;
+    result.count = nodes;
+    auto const start = benchmark_clock::now();
+    op();
+    result.seconds =
+        std::chrono::duration<double>(benchmark_clock::now() - start).count();
+    return result;
+}
+
+void print_header() {
+    std::cout << "batch p50 and p99 are percentiles of the mean ns per "
+                 "operation over each batch of ops/batch operations"
+              << std::endl;
+    std::cout << std::left << std::setw(12) << "shape" << std::setw(28)
+              << "operation" << std::setw(26) << "implementation"
+              << std::right << std::setw(8) << "count" << std::setw(10)
+              << "Mops/s" << std::setw(11) << "ops/batch" << std::setw(11)
+              << "batch p50" << std::setw(11) << "batch p99" << std::setw(12)
+              << "bytes/node" << std::endl;
+}
+
+void report(
+    char const *shape, char const *operation, char const *implementation,
+    measurement &m, double bytes_per_node = -1) {
+    std::cout << std::left << std::setw(12) << shape << std::setw(28)
+              << operation << std::setw(26) << implementation << std::right
+              << std::setw(8) << m.count << std::fixed << std::setprecision(2)
+              << std::setw(10) << m.count / m.seconds / 1e6;
+    if (m.samples.empty()) {
+        std::cout << std::setw(11) << "-" << std::setw(11) << "-"
+                  << std::setw(11) << "-";
+    } else {
+        std::cout << std::setw(11) << m.batch;
+        std::sort(m.samples.begin(), m.samples.end());
+        auto const percentile = [&](double p) {
+            return m.samples[std::min(
+                m.samples.size() - 1,
+                static_cast<std::size_t>(m.samples.size() * p))];
+        };
+        std::cout << std::setprecision(1) << std::setw(11) << percentile(0.5)
+                  << std::setw(11) << percentile(0.99);
+    }
+    if (bytes_per_node >= 0)
+        std::cout << std::setprecision(1) << std::setw(12) << bytes_per_node;
+    std::cout << std::endl;
+}
+
+struct ListNode : jss::internal_base {
+    jss::internal_ptr<ListNode> next;
+    unsigned value = 0;
+
+    ListNode() : next(this) {}
+};
+
+struct SharedListNode {
+    std::shared_ptr<SharedListNode> next;
+    unsigned value = 0;
+};
+
+struct UniqueListNode {
+    std::unique_ptr<UniqueListNode> next;
+    unsigned value = 0;
+};
+
+void single_nodes() {
+    std::vector<jss::root_ptr<ListNode>> roots;
+    roots.reserve(node_count);
+    {
+        memory_probe probe;
+        auto m = measure(node_count, cheap_batch, [&](std::size_t) {
+            roots.push_back(jss::make_root<ListNode>());
+        });
+        report("node", "create", "make_root", m, probe.per_node(node_count));
+    }
+    {
+        auto m = measure(node_count, cheap_batch, [&](std::size_t) {
+            roots.pop_back();
+        });
+        report("node", "destroy", "root_ptr", m);
+    }
+    {
+        memory_probe probe;
+        auto m = measure(node_count, cheap_batch, [&](std::size_t) {
+            roots.push_back(jss::make_pooled_root<ListNode>());
+        });
+        report(
+            "node", "create", "make_pooled_root", m,
+            probe.per_node(node_count));
+        roots.clear();
+    }
+    {
+        std::vector<std::shared_ptr<SharedListNode>> shared;
+        shared.reserve(node_count);
+        memory_probe probe;
+        auto m = measure(node_count, cheap_batch, [&](std::size_t) {
+            shared.push_back(std::make_shared<SharedListNode>());
+        });
+        report(
+            "node", "create", "std::make_shared", m,
+            probe.per_node(node_count));
+        m = measure(node_count, cheap_batch, [&](std::size_t) {
+            shared.pop_back();
+        });
+        report("node", "destroy", "std::shared_ptr", m);
+    }
+    {
+        std::vector<std::unique_ptr<UniqueListNode>> unique;
+        unique.reserve(node_count);
+        memory_probe probe;
+        auto m = measure(node_count, cheap_batch, [&](std::size_t) {
+            unique.push_back(std::make_unique<UniqueListNode>());
+        });
+        report(
+            "node", "create", "std::make_unique", m,
+            probe.per_node(node_count));
+        m = measure(node_count, cheap_batch, [&](std::size_t) {
+            unique.pop_back();
+        });
+        report("node", "destroy", "std::unique_ptr", m);
+    }
+
+    unsigned const operations = node_count * 4;
+    {
+        auto const root = jss::make_root<ListNode>();
+        auto m = measure(operations, cheap_batch, [&](std::size_t) {
+            jss::root_ptr<ListNode> copy(root);
+            keep(copy);
+        });
+        report("node", "copy and destroy", "root_ptr", m);
+    }
+    {
+        auto const root = std::make_shared<SharedListNode>();
+        auto m = measure(operations, cheap_batch, [&](std::size_t) {
+            std::shared_ptr<SharedListNode> copy(root);
+            keep(copy);
+        });
+        report("node", "copy and destroy", "std::shared_ptr", m);
+    }
+    {
+        auto const holder = jss::make_root<ListNode>();
+        jss::root_ptr<ListNode> const targets[] = {
+            jss::make_root<ListNode>(), jss::make_root<ListNode>()};
+        auto m = measure(operations, cheap_batch, [&](std::size_t i) {
+            holder->next = targets[i & 1];
+        });
+        report("node", "assign owned target", "internal_ptr", m);
+    }
+    {
+        auto const holder = std::make_shared<SharedListNode>();
+        std::shared_ptr<SharedListNode> const targets[] = {
+            std::make_shared<SharedListNode>(),
+            std::make_shared<SharedListNode>()};
+        auto m = measure(operations, cheap_batch, [&](std::size_t i) {
+            holder->next = targets[i & 1];
+        });
+        report("node", "assign owned target", "std::shared_ptr", m);
+    }
+}
+
+// Nodes are pushed on the front and popped off again; the baselines are
+// dropped with the same loop, since their destructors would recurse
+template <typename Head, typename Make>
+void list_with(char const *implementation, Make make) {
+    Head head;
+    {
+        memory_probe probe;
+        auto m = measure(node_count, cheap_batch, [&](std::size_t) {
+            auto node = make();
+            node->next = std::move(head);
+            head = std::move(node);
+        });
+        report("list", "push front", implementation, m, probe.per_node(node_count));
+    }
+    {
+        auto m = measure(node_count, cheap_batch, [&](std::size_t) {
+            Head next(std::move(head->next));
+            head = std::move(next);
+        });
+        report("list", "pop front", implementation, m);
+    }
+}
+
+void singly_linked_list() {
+    list_with<jss::root_ptr<ListNode>>(
+        "root_ptr/internal_ptr", [] { return jss::make_root<ListNode>(); });
+    list_with<std::shared_ptr<SharedListNode>>("std::shared_ptr", [] {
+        return std::make_shared<SharedListNode>();
+    });
+    list_with<std::unique_ptr<UniqueListNode>>("std::unique_ptr", [] {
+        return std::make_unique<UniqueListNode>();
+    });
+
+    jss::root_ptr<ListNode> head;
+    for (unsigned i = 0; i < node_count; ++i) {
+        auto node = jss::make_root<ListNode>();
+        node->next = head;
+        head = node;
+    }
+    auto m = measure_whole(node_count, [&] { head.reset(); });
+    report("list", "drop whole", "root_ptr/internal_ptr", m);
+}
+
+template <template <typename> class Parent>
+struct TreeNode : jss::internal_base {
+    jss::internal_ptr<TreeNode> left, right;
+    Parent<TreeNode> parent;
+    unsigned value = 0;
+
+    TreeNode() : left(this), right(this), parent(this) {}
+};
+
+struct SharedTreeNode {
+    std::shared_ptr<SharedTreeNode> left, right;
+    std::weak_ptr<SharedTreeNode> parent;
+    unsigned value = 0;
+};
+
+struct UniqueTreeNode {
+    std::unique_ptr<UniqueTreeNode> left, right;
+    UniqueTreeNode *parent = nullptr;
+    unsigned value = 0;
+};
+
+unsigned const leaf_cuts = 1024;
+
+// The nodes of a complete binary tree in level order; slots[i] is the
+// child pointer in the parent of node i. The tree is built level by level,
+// and then the leaves are cut off one by one
+template <typename Node, typename Root, typename Slot> class tree_builder {
+    std::vector<Node *> nodes;
+    std::vector<Slot *> slots;
+
+  public:
+    tree_builder() {
+        nodes.reserve(node_count);
+        slots.reserve(node_count);
+    }
+
+    template <typename Make, typename Link>
+    measurement build(Root &root, Make make, Link link) {
+        nodes.clear();
+        slots.clear();
+        root = make();
+        nodes.push_back(&*root);
+        slots.push_back(nullptr);
+        return measure(node_count - 1, cheap_batch, [&](std::size_t i) {
+            auto const parent_index = i / 2;
+            auto &parent = *nodes[parent_index];
+            auto &slot = (i & 1) ? parent.right : parent.left;
+            slot = make();
+            if (parent_index)
+                link(*slot, *slots[parent_index]);
+            else
+                link(*slot, root);
+            nodes.push_back(&*slot);
+            slots.push_back(&slot);
+        });
+    }
+
+    // With counted parent links each cut searches most of the tree, so
+    // only some of the leaves are cut
+    measurement cut_leaves() {
+        auto const first_leaf = node_count / 2;
+        return measure(leaf_cuts, 1, [&](std::size_t i) {
+            slots[first_leaf + i]->reset();
+        });
+    }
+};
+
+template <template <typename> class Parent>
+void tree_with(char const *implementation) {
+    typedef TreeNode<Parent> Node;
+    tree_builder<Node, jss::root_ptr<Node>, jss::internal_ptr<Node>> builder;
+    jss::root_ptr<Node> root;
+    auto const make = [] { return jss::make_root<Node>(); };
+    auto const link = [](Node &child, auto const &parent) {
+        child.parent = parent;
+    };
+    {
+        memory_probe probe;
+        auto m = builder.build(root, make, link);
+        report("tree", "build", implementation, m, probe.per_node(node_count));
+    }
+    auto m = builder.cut_leaves();
+    report("tree", "cut leaf", implementation, m);
+    builder.build(root, make, link);
+    m = measure_whole(node_count, [&] { root.reset(); });
+    report("tree", "drop whole", implementation, m);
+}
+
+void tree_with_parent_links() {
+    tree_with<jss::internal_ptr>("internal_ptr parent");
+    tree_with<jss::weak_internal_ptr>("weak_internal_ptr parent");
+    {
+        typedef std::shared_ptr<SharedTreeNode> Ptr;
+        tree_builder<SharedTreeNode, Ptr, Ptr> builder;
+        Ptr root;
+        auto const make = [] { return std::make_shared<SharedTreeNode>(); };
+        auto const link = [](SharedTreeNode &child, Ptr const &parent) {
+            child.parent = parent;
+        };
+        memory_probe probe;
+        auto m = builder.build(root, make, link);
+        report(
+            "tree", "build", "std::shared_ptr/weak_ptr", m,
+            probe.per_node(node_count));
+        m = builder.cut_leaves();
+        report("tree", "cut leaf", "std::shared_ptr/weak_ptr", m);
+        builder.build(root, make, link);
+        m = measure_whole(node_count, [&] { root.reset(); });
+        report("tree", "drop whole", "std::shared_ptr/weak_ptr", m);
+    }
+    {
+        typedef std::unique_ptr<UniqueTreeNode> Ptr;
+        tree_builder<UniqueTreeNode, Ptr, Ptr> builder;
+        Ptr root;
+        auto const make = [] { return std::make_unique<UniqueTreeNode>(); };
+        auto const link = [](UniqueTreeNode &child, Ptr const &parent) {
+            child.parent = parent.get();
+        };
+        memory_probe probe;
+        auto m = builder.build(root, make, link);
+        report(
+            "tree", "build", "std::unique_ptr/raw", m,
+            probe.per_node(node_count));
+        m = builder.cut_leaves();
+        report("tree", "cut leaf", "std::unique_ptr/raw", m);
+        builder.build(root, make, link);
+        m = measure_whole(node_count, [&] { root.reset(); });
+        report("tree", "drop whole", "std::unique_ptr/raw", m);
+    }
+}
+
+struct DagNode : jss::internal_base {
+    jss::internal_ptr<DagNode> first, second;
+    unsigned value = 0;
+
+    DagNode() : first(this), second(this) {}
+};
+
+struct SharedDagNode {
+    std::shared_ptr<SharedDagNode> first, second;
+    unsigned value = 0;
+};
+
+// Layers of nodes, each with edges to two random nodes in the next layer,
+// so most nodes are shared; only the first layer is held from outside
+unsigned const dag_width = 1024;
+
+template <typename Ptr, typename Make>
+void dag_with(char const *implementation, Make make) {
+    std::vector<Ptr> nodes;
+    nodes.reserve(node_count);
+    std::mt19937 rng(1);
+    auto const random_below = [&](unsigned layer) {
+        return (layer + 1) * dag_width + rng() % dag_width;
+    };
+    auto const build = [&] {
+        for (unsigned i = 0; i < node_count; ++i)
+            nodes.push_back(make());
+        for (unsigned i = 0; i + dag_width < node_count; ++i) {
+            nodes[i]->first = nodes[random_below(i / dag_width)];
+            nodes[i]->second = nodes[random_below(i / dag_width)];
+        }
+    };
+    {
+        memory_probe probe;
+        auto m = measure_whole(node_count, build);
+        report("dag", "build", implementation, m, probe.per_node(node_count));
+    }
+    {
+        auto m = measure(node_count - dag_width, 1, [&](std::size_t i) {
+            nodes[node_count - 1 - i] = nullptr;
+        });
+        report("dag", "drop external pointer", implementation, m);
+    }
+    {
+        // Skipping a layer keeps the graph acyclic
+        auto m = measure(node_count / 4, 1, [&](std::size_t) {
+            auto &from = *nodes[rng() % dag_width];
+            from.first = from.second->first;
+        });
+        report("dag", "reassign edge", implementation, m);
+    }
+    auto m = measure_whole(node_count, [&] { nodes.clear(); });
+    report("dag", "drop whole", implementation, m);
+}
+
+void directed_acyclic_graph() {
+    dag_with<jss::root_ptr<DagNode>>(
+        "root_ptr/internal_ptr", [] { return jss::make_root<DagNode>(); });
+    dag_with<std::shared_ptr<SharedDagNode>>("std::shared_ptr", [] {
+        return std::make_shared<SharedDagNode>();
+    });
+}
+
+// A shared_ptr ring is never freed, so the baseline breaks it by hand
+void cyclic_ring() {
+    {
+        std::vector<jss::root_ptr<ListNode>> nodes;
+        nodes.reserve(node_count);
+        memory_probe probe;
+        auto m = measure_whole(node_count, [&] {
+            for (unsigned i = 0; i < node_count; ++i)
+                nodes.push_back(jss::make_root<ListNode>());
+            for (unsigned i = 0; i < node_count; ++i)
+                nodes[i]->next = nodes[(i + 1) % node_count];
+        });
+        report(
+            "ring", "build", "root_ptr/internal_ptr", m,
+            probe.per_node(node_count));
+        m = measure(node_count - 1, 1, [&](std::size_t) { nodes.pop_back(); });
+        report("ring", "drop external pointer", "root_ptr/internal_ptr", m);
+        m = measure_whole(node_count, [&] { nodes.clear(); });
+        report("ring", "drop whole", "root_ptr/internal_ptr", m);
+    }
+    {
+        std::vector<std::shared_ptr<SharedListNode>> nodes;
+        nodes.reserve(node_count);
+        memory_probe probe;
+        auto m = measure_whole(node_count, [&] {
+            for (unsigned i = 0; i < node_count; ++i)
+                nodes.push_back(std::make_shared<SharedListNode>());
+            for (unsigned i = 0; i < node_count; ++i)
+                nodes[i]->next = nodes[(i + 1) % node_count];
+        });
+        report(
+            "ring", "build", "std::shared_ptr", m,
+            probe.per_node(node_count));
+        m = measure(node_count - 1, 1, [&](std::size_t) { nodes.pop_back(); });
+        report("ring", "drop external pointer", "std::shared_ptr", m);
+        m = measure_whole(node_count, [&] {
+            auto const head = nodes[0].get();
+            nodes.clear();
+            auto next = std::move(head->next);
+            while (next)
+                next = std::move(next->next);
+        });
+        report("ring", "drop whole, cycle broken", "std::shared_ptr", m);
+    }
+}
+
+struct Spoke : jss::internal_base {
+    jss::internal_ptr<ListNode> hub;
+    unsigned value = 0;
+
+    Spoke() : hub(this) {}
+};
+
+struct SharedSpoke {
+    std::shared_ptr<SharedListNode> hub;
+    unsigned value = 0;
+};
+
+// Every spoke points at the same hub, so the hub has a huge set of
+// back-pointers. Once the hub has no owner of its own, dropping a spoke
+// leaves the hub to be checked
+void hub_with_fan_in() {
+    {
+        std::vector<jss::root_ptr<Spoke>> spokes;
+        spokes.reserve(node_count);
+        auto hub = jss::make_root<ListNode>();
+        auto const build = [&] {
+            return measure(node_count, cheap_batch, [&](std::size_t) {
+                spokes.push_back(jss::make_root<Spoke>());
+                spokes.back()->hub = hub;
+            });
+        };
+        memory_probe probe;
+        auto m = build();
+        report(
+            "hub", "add spoke", "root_ptr/internal_ptr", m,
+            probe.per_node(node_count));
+        m = measure(node_count, 1, [&](std::size_t) { spokes.pop_back(); });
+        report("hub", "drop spoke, owned hub", "root_ptr/internal_ptr", m);
+        build();
+        hub.reset();
+        m = measure(node_count, 1, [&](std::size_t) { spokes.pop_back(); });
+        report("hub", "drop spoke, unowned hub", "root_ptr/internal_ptr", m);
+    }
+    {
+        std::vector<std::shared_ptr<SharedSpoke>> spokes;
+        spokes.reserve(node_count);
+        auto hub = std::make_shared<SharedListNode>();
+        memory_probe probe;
+        auto m = measure(node_count, cheap_batch, [&](std::size_t) {
+            spokes.push_back(std::make_shared<SharedSpoke>());
+            spokes.back()->hub = hub;
+        });
+        report(
+            "hub", "add spoke", "std::shared_ptr", m,
+            probe.per_node(node_count));
+        hub.reset();
+        m = measure(node_count, 1, [&](std::size_t) { spokes.pop_back(); });
+        report("hub", "drop spoke", "std::shared_ptr", m);
+    }
+}
+
+int main() {
+    print_header();
+    single_nodes();
+    singly_linked_list();
+    tree_with_parent_links();
+    directed_acyclic_graph();
+    cyclic_ring();
+    hub_with_fan_in();
+}
@@ -2,6 +2,8 @@
 #include <iostream>
 #include "internal_ptr.hpp"
 #include <vector>
+#include <atomic>
+#include <thread>
 
 struct Counted{
     Counted(){
@@ -661,6 +663,1284 @@ void pointers_are_null_in_destructor(){
     x.p.reset();
 }
 
+void node_with_changing_number_of_parents(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> p;
+        Counted data;
+
+        X():
+            p(this){}
+    };
+
+    {
+        auto target=jss::make_root<X>();
+        std::vector<jss::root_ptr<X>> parents;
+        for(unsigned i=0;i<20;++i){
+            parents.push_back(jss::make_root<X>());
+            parents.back()->p=target;
+            assert(target.use_count()==i+2);
+        }
+        assert(Counted::instances==21);
+        while(parents.size()>1){
+            parents.pop_back();
+            assert(target.use_count()==parents.size()+1);
+        }
+        target.reset();
+        assert(Counted::instances==2);
+        assert(parents.front()->p);
+        for(unsigned i=0;i<5;++i){
+            parents.push_back(jss::make_root<X>());
+            parents.back()->p=parents.front()->p;
+        }
+        parents.front()->p->p=parents.back();
+        assert(Counted::instances==7);
+        parents.erase(parents.begin());
+        assert(Counted::instances==6);
+    }
+    assert(Counted::instances==0);
+}
+
+void hub_with_many_parents(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> p1,p2;
+        Counted data;
+
+        X():
+            p1(this),p2(this){}
+    };
+
+    {
+        auto hub=jss::make_root<X>();
+        std::vector<jss::root_ptr<X>> parents;
+        for(unsigned i=0;i<500;++i){
+            parents.push_back(jss::make_root<X>());
+            parents.back()->p1=hub;
+            if(i%3==0)
+                parents.back()->p2=hub;
+        }
+        assert(hub.use_count()==668);
+        hub->p1=parents[7];
+        hub.reset();
+        assert(Counted::instances==501);
+        for(unsigned i=0;i<parents.size();i+=2){
+            if(i!=6)
+                parents[i].reset();
+        }
+        assert(Counted::instances==252);
+        for(unsigned i=1;i<parents.size();i+=2){
+            if(i!=7)
+                parents[i].reset();
+        }
+        assert(Counted::instances==3);
+        parents[6].reset();
+        assert(Counted::instances==2);
+        assert(parents[7]->p1->p1==parents[7]);
+    }
+    assert(Counted::instances==0);
+}
+
+void destructor_drops_other_structure(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct Y:jss::internal_base{
+        jss::internal_ptr<Y> next;
+        Counted data;
+
+        Y():
+            next(this){}
+    };
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> p;
+        jss::root_ptr<Y> other;
+        Counted data;
+
+        X():
+            p(this){}
+
+        ~X(){
+            if(other){
+                auto const before=Counted::instances;
+                other.reset();
+                assert(Counted::instances==before-2);
+            }
+        }
+    };
+
+    {
+        auto x=jss::make_root<X>();
+        x->p=jss::make_root<X>();
+        x->p->p=x;
+        x->p->other=jss::make_root<Y>();
+        x->p->other->next=jss::make_root<Y>();
+        x->p->other->next->next=x->p->other;
+        assert(Counted::instances==4);
+    }
+    assert(Counted::instances==0);
+}
+
+void large_graph_with_cycles_destroyed(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> next,skip;
+        Counted data;
+
+        X():
+            next(this),skip(this){}
+    };
+
+    {
+        std::vector<jss::root_ptr<X>> nodes;
+        for(unsigned i=0;i<2000;++i)
+            nodes.push_back(jss::make_root<X>());
+        for(unsigned i=0;i<nodes.size();++i){
+            nodes[i]->next=nodes[(i+1)%nodes.size()];
+            nodes[i]->skip=nodes[(i*7+3)%nodes.size()];
+        }
+        auto head=nodes[0];
+        nodes.clear();
+        assert(Counted::instances==2000);
+        head->next->next->skip.reset();
+        assert(Counted::instances==2000);
+    }
+    assert(Counted::instances==0);
+}
+
+void deferred_collection_batches_drops(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> next;
+        Counted data;
+
+        X():
+            next(this){}
+    };
+
+    {
+        auto head=jss::make_root<X>();
+        {
+            jss::deferred_collection scope;
+            auto node=head;
+            for(unsigned i=0;i<10;++i){
+                node->next=jss::make_root<X>();
+                node=node->next;
+            }
+            node->next=head;
+            node.reset();
+            assert(Counted::instances==11);
+            for(unsigned i=0;i<10;++i){
+                jss::root_ptr<X> second(head->next);
+                head->next=second->next;
+                second->next=head->next;
+                head->next=second;
+            }
+            assert(Counted::instances==11);
+            head->next->next.reset();
+            assert(Counted::instances==11);
+            jss::collect();
+            assert(Counted::instances==2);
+            head.reset();
+            assert(Counted::instances==2);
+        }
+        assert(Counted::instances==0);
+    }
+    {
+        jss::deferred_collection outer;
+        {
+            jss::deferred_collection inner;
+            auto p=jss::make_root<X>();
+            p->next=p;
+        }
+        assert(Counted::instances==1);
+    }
+    assert(Counted::instances==0);
+}
+
+void trial_deletion_engine(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> p1,p2;
+        Counted data;
+
+        X():
+            p1(this),p2(this){}
+    };
+
+    jss::set_collection_engine(jss::collection_engine::trial_deletion);
+    assert(jss::get_collection_engine()==jss::collection_engine::trial_deletion);
+    {
+        auto x=jss::make_root<X>();
+        x->p1=jss::make_root<X>();
+        x->p1->p1=jss::make_root<X>();
+        x->p1->p1->p1=x->p1;
+        x->p1->p2=jss::make_root<X>();
+        assert(Counted::instances==4);
+        x->p1.reset();
+        assert(Counted::instances==4);
+        jss::collect();
+        assert(Counted::instances==1);
+        assert(!x->p1);
+
+        x->p1=jss::make_root<X>();
+        x->p1->p1=jss::make_root<X>();
+        x->p1->p1->p1=x->p1;
+        x->p2=x->p1->p1;
+        x->p1.reset();
+        jss::collect();
+        assert(Counted::instances==3);
+        x->p2.reset();
+        jss::collect();
+        assert(Counted::instances==1);
+
+        x->p1=jss::make_root<X>();
+        x->p1->p1=jss::make_root<X>();
+        x->p1->p1->p1=jss::make_root<X>();
+        assert(Counted::instances==4);
+        x->p1.reset();
+        assert(Counted::instances==1);
+    }
+    assert(Counted::instances==0);
+
+    jss::collect();
+    jss::set_candidate_buffer_size(4);
+    {
+        std::vector<jss::root_ptr<X>> nodes;
+        for(unsigned i=0;i<3;++i){
+            nodes.push_back(jss::make_root<X>());
+            nodes.back()->p1=nodes.back();
+        }
+        nodes.clear();
+        assert(Counted::instances==3);
+        auto y=jss::make_root<X>();
+        y->p1=y;
+        y.reset();
+        assert(Counted::instances==0);
+    }
+    jss::set_candidate_buffer_size(1024);
+
+    std::thread([]{
+        auto x=jss::make_root<X>();
+        x->p1=jss::make_root<X>();
+        x->p1->p1=x;
+    }).join();
+    assert(Counted::instances==2);
+    jss::collect();
+    assert(Counted::instances==0);
+    jss::set_collection_engine(jss::collection_engine::back_pointer_search);
+}
+
+void repeated_drops_reuse_reachability_proofs(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> next,other;
+        std::vector<jss::internal_ptr<X>> children;
+        Counted data;
+
+        X():
+            next(this),other(this){}
+    };
+
+    {
+        auto head=jss::make_root<X>();
+        jss::local_ptr<X> node=head;
+        for(unsigned i=0;i<10;++i){
+            node->next=jss::make_root<X>();
+            node=node->next;
+        }
+        jss::local_ptr<X> last=node;
+        auto spare=jss::make_root<X>();
+        for(unsigned i=0;i<5;++i){
+            auto child=jss::make_root<X>();
+            last->children.emplace_back(last.get(),child);
+            spare->children.emplace_back(spare.get(),child);
+        }
+        assert(Counted::instances==17);
+
+        jss::reset_reachability_cache_stats();
+        while(!spare->children.empty())
+            spare->children.pop_back();
+        auto stats=jss::get_reachability_cache_stats();
+        assert(stats.hits>=4);
+        assert(stats.searches<=stats.hits+1);
+        assert(Counted::instances==17);
+
+        head->next->next.reset();
+        assert(Counted::instances==3);
+        auto const invalidations=
+            jss::get_reachability_cache_stats().invalidations;
+        assert(invalidations>stats.invalidations);
+    }
+    assert(Counted::instances==0);
+}
+
+void dying_structure_with_reachable_children(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> next,other;
+        Counted data;
+
+        X():
+            next(this),other(this){}
+    };
+
+    {
+        auto kept=jss::make_root<X>();
+        auto outside=jss::make_root<X>();
+        {
+            auto head=jss::make_root<X>();
+            jss::local_ptr<X> node=head;
+            for(unsigned i=0;i<20;++i){
+                node->next=jss::make_root<X>();
+                node=node->next;
+                if(i%5==0){
+                    node->other=jss::make_root<X>();
+                    node->other->next=jss::make_root<X>();
+                    node->other->next->next=node->other;
+                }
+            }
+            node->next=head;
+            head->next->next->other=kept;
+            head->next->other->other=jss::make_root<X>();
+            outside->other=head->next->other->other;
+            kept->next=jss::make_root<X>();
+            kept->next->other=head->next;
+            assert(Counted::instances==33);
+        }
+        assert(Counted::instances==33);
+        kept->next->other.reset();
+        assert(Counted::instances==4);
+        assert(outside->other);
+        assert(!outside->other->next);
+    }
+    assert(Counted::instances==0);
+}
+
+void pooled_roots_reuse_slab_memory(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> next;
+        Counted data;
+
+        X():
+            next(this){}
+    };
+
+    {
+        auto head=jss::make_pooled_root<X>();
+        jss::local_ptr<X> node=head;
+        for(unsigned i=0;i<99;++i){
+            node->next=jss::make_pooled_root<X>();
+            node=node->next;
+        }
+        node->next=head;
+        assert(Counted::instances==100);
+        auto stats=jss::get_root_pool_stats<X>();
+        assert(stats.in_use==100);
+        assert(stats.capacity>=100);
+
+        head.reset();
+        assert(Counted::instances==0);
+        assert(jss::get_root_pool_stats<X>().in_use==0);
+
+        for(unsigned i=0;i<100;++i)
+            jss::make_pooled_root<X>();
+        assert(jss::get_root_pool_stats<X>().slabs==stats.slabs);
+    }
+    assert(Counted::instances==0);
+}
+
+void pooled_roots_respect_over_alignment(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct alignas(128) X:jss::internal_base{
+        jss::internal_ptr<X> next;
+        Counted data;
+
+        X():
+            next(this){}
+    };
+
+    {
+        std::vector<jss::root_ptr<X>> nodes;
+        for(unsigned i=0;i<200;++i){
+            nodes.push_back(jss::make_pooled_root<X>());
+            assert(reinterpret_cast<std::uintptr_t>(nodes.back().get())%128==0);
+            if(i)
+                nodes[i-1]->next=nodes[i];
+        }
+        nodes.back()->next=nodes.front();
+        assert(Counted::instances==200);
+    }
+    assert(Counted::instances==0);
+    assert(jss::get_root_pool_stats<X>().in_use==0);
+}
+
+template<typename T>
+struct CountingAllocator{
+    typedef T value_type;
+
+    int* allocations;
+
+    explicit CountingAllocator(int* allocations_):
+        allocations(allocations_){}
+
+    template<typename U>
+    CountingAllocator(CountingAllocator<U> const& other):
+        allocations(other.allocations){}
+
+    T* allocate(std::size_t n){
+        ++*allocations;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p,std::size_t n){
+        --*allocations;
+        std::allocator<T>().deallocate(p,n);
+    }
+};
+
+template<typename T,typename U>
+bool operator==(CountingAllocator<T> const& lhs,CountingAllocator<U> const& rhs){
+    return lhs.allocations==rhs.allocations;
+}
+
+template<typename T,typename U>
+bool operator!=(CountingAllocator<T> const& lhs,CountingAllocator<U> const& rhs){
+    return !(lhs==rhs);
+}
+
+void allocate_root_uses_allocator(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> next;
+        Counted data;
+
+        X():
+            next(this){}
+    };
+
+    int allocations=0;
+    {
+        CountingAllocator<X> alloc(&allocations);
+        auto head=jss::allocate_root<X>(alloc);
+        head->next=jss::allocate_root<X>(alloc);
+        head->next->next=head;
+        jss::root_ptr<X> separate(new X,std::default_delete<X>(),alloc);
+        separate->next=head;
+        assert(allocations==3);
+        assert(Counted::instances==3);
+
+        head.reset();
+        assert(allocations==3);
+        separate.reset();
+        assert(Counted::instances==0);
+        assert(allocations==0);
+    }
+}
+
+class CountingResource:public std::pmr::memory_resource{
+    void* do_allocate(std::size_t bytes,std::size_t alignment) override{
+        outstanding+=bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes,alignment);
+    }
+
+    void do_deallocate(void* p,std::size_t bytes,std::size_t alignment) override{
+        outstanding-=bytes;
+        std::pmr::new_delete_resource()->deallocate(p,bytes,alignment);
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override{
+        return this==&other;
+    }
+
+public:
+    std::size_t outstanding=0;
+};
+
+void bookkeeping_uses_memory_resource(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        std::vector<jss::internal_ptr<X>> children;
+        Counted data;
+    };
+
+    CountingResource global;
+    auto const previous=jss::set_bookkeeping_resource(&global);
+    assert(jss::get_bookkeeping_resource()==&global);
+    {
+        CountingResource scoped;
+        auto hub=jss::make_root<X>();
+        auto parent=jss::make_root<X>();
+        auto const add_parents=[&]{
+            for(unsigned i=0;i<100;++i){
+                parent->children.emplace_back(parent.get(),hub);
+                auto next=jss::make_root<X>();
+                next->children.emplace_back(next.get(),parent);
+                parent=next;
+            }
+        };
+        {
+            jss::bookkeeping_resource_scope scope(&scoped);
+            add_parents();
+        }
+        assert(scoped.outstanding>0);
+        add_parents();
+        assert(scoped.outstanding==0);
+        assert(global.outstanding>0);
+        hub.reset();
+        assert(Counted::instances==202);
+        parent.reset();
+        assert(Counted::instances==0);
+        assert(scoped.outstanding==0);
+    }
+    jss::set_bookkeeping_resource(previous);
+    assert(global.outstanding==0);
+}
+
+void back_pointer_storage_grows_and_shrinks(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> child;
+
+        X():
+            child(this){}
+    };
+
+    CountingResource resource;
+    auto const previous=jss::set_bookkeeping_resource(&resource);
+    {
+        auto hub=jss::make_root<X>();
+        std::vector<jss::root_ptr<X>> parents;
+        for(unsigned i=0;i<200;++i){
+            parents.push_back(jss::make_root<X>());
+            parents.back()->child=hub;
+            if(i==1)
+                assert(resource.outstanding==0);
+            if(i==2)
+                assert(resource.outstanding>0);
+        }
+        auto const hashed=resource.outstanding;
+        for(unsigned i=199;i!=14;--i)
+            parents[i]->child.reset();
+        assert(resource.outstanding>0);
+        assert(resource.outstanding<hashed);
+        for(unsigned i=14;i!=0;--i)
+            parents[i]->child.reset();
+        assert(resource.outstanding==0);
+        parents[1]->child=hub;
+        assert(resource.outstanding==0);
+        assert(hub.use_count()==3);
+    }
+    jss::set_bookkeeping_resource(previous);
+    assert(resource.outstanding==0);
+}
+
+void arena_released_as_a_whole(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> next,other;
+        Counted data;
+
+        X():
+            next(this),other(this){}
+    };
+
+    CountingResource upstream;
+    auto outside=jss::make_root<X>();
+    {
+        jss::root_ptr<X> head;
+        {
+            jss::root_arena arena(256,&upstream);
+            head=arena.make_root<X>();
+            jss::local_ptr<X> node=head;
+            for(unsigned i=0;i<50;++i){
+                node->next=arena.make_root<X>();
+                node=node->next;
+            }
+            node->next=head;
+            node->other=outside;
+            outside->other=head->next;
+            assert(head.use_count()==3);
+            arena.make_root<int>(42);
+            assert(upstream.outstanding>256);
+        }
+        assert(Counted::instances==52);
+        head.reset();
+        assert(Counted::instances==52);
+        assert(outside->other->next);
+        outside->other.reset();
+        assert(Counted::instances==1);
+        assert(!outside->other);
+    }
+    assert(upstream.outstanding==0);
+    outside.reset();
+    assert(Counted::instances==0);
+}
+
+void pointers_removed_from_middle_of_node(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        std::vector<jss::internal_ptr<X>> children;
+        jss::internal_ptr<X> last;
+        Counted data;
+
+        X():
+            last(this){}
+    };
+
+    {
+        auto x=jss::make_root<X>();
+        x->children.reserve(1000);
+        for(unsigned i=0;i<1000;++i){
+            x->children.emplace_back(x.get(),jss::make_root<X>());
+        }
+        x->last=x->children.front();
+        assert(Counted::instances==1001);
+        for(unsigned i=1;i<x->children.size();++i){
+            std::swap(x->children[i],x->children.back());
+            x->children.pop_back();
+        }
+        assert(Counted::instances==501);
+        x->children.clear();
+        assert(Counted::instances==2);
+        assert(x->last);
+        x->last.reset();
+        assert(Counted::instances==1);
+    }
+    assert(Counted::instances==0);
+}
+
+void internal_ptr_vector_edges(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr_vector<X> children;
+        Counted data;
+
+        X():
+            children(this){}
+    };
+
+    {
+        auto x=jss::make_root<X>();
+        std::vector<jss::root_ptr<X>> nodes;
+        for(unsigned i=0;i<100;++i){
+            nodes.push_back(jss::make_root<X>());
+            x->children.push_back(nodes.back());
+            nodes.back()->children.push_back(x);
+        }
+        auto kept=nodes.back();
+        nodes.clear();
+        assert(Counted::instances==101);
+        assert(x->children.size()==100);
+        assert(x->children[10]->children[0]==x.get());
+        auto const begin=x->children.begin();
+        auto const end=x->children.end();
+        assert((begin<end) && (end>begin) && (begin<=begin) && (end>=begin));
+        assert(2+begin==begin+2);
+        assert(end-begin==100);
+
+        x->children.erase(x->children.begin()+10,x->children.begin()+60);
+        assert(Counted::instances==51);
+        x->children.erase(x->children.begin());
+        assert(Counted::instances==50);
+
+        std::vector<jss::root_ptr<X>> replacement{kept,jss::make_root<X>()};
+        kept.reset();
+        x->children.assign(replacement.begin(),replacement.end());
+        assert(Counted::instances==3);
+        assert(x->children.size()==2);
+        auto last=replacement.back();
+        replacement.clear();
+        assert(Counted::instances==3);
+
+        x->children.pop_back();
+        assert(Counted::instances==3);
+        {
+            struct Y:X{};
+            auto y=jss::make_root<Y>();
+            x->children.push_back(y);
+            assert(x->children[1]==y.get());
+        }
+        assert(Counted::instances==4);
+        x.reset();
+        assert(Counted::instances==1);
+        assert(last->children.empty());
+    }
+    assert(Counted::instances==0);
+}
+
+void moves_and_swaps_within_a_node_do_not_scan(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> p1,p2;
+        Counted data;
+
+        X():
+            p1(this),p2(this){}
+    };
+
+    {
+        auto a=jss::make_root<X>();
+        auto b=jss::make_root<X>();
+        a->p1=jss::make_root<X>();
+        a->p1->p1=a->p1;
+        a->p1->p2=jss::make_root<X>();
+        a->p1->p2->p1=a->p1;
+        b->p1=jss::make_root<X>();
+        b->p1->p1=b;
+        assert(Counted::instances==5);
+
+        jss::reset_reachability_cache_stats();
+        a->p1.swap(a->p2);
+        assert(!a->p1);
+        assert(jss::get_reachability_cache_stats().searches==0);
+        swap(a->p2,b->p1);
+        assert(a->p2->p1==b);
+        assert(b->p1->p2->p1==b->p1);
+        jss::reset_reachability_cache_stats();
+        b->p2=std::move(b->p1);
+        assert(!b->p1);
+        assert(jss::get_reachability_cache_stats().searches==0);
+        a->p1=std::move(b->p2);
+        assert(!b->p2);
+        assert(Counted::instances==5);
+
+        a->p2.swap(a->p1);
+        a->p1=std::move(a->p2);
+        assert(Counted::instances==4);
+        b.reset();
+        assert(Counted::instances==3);
+    }
+    assert(Counted::instances==0);
+    {
+        auto a=jss::make_root<X>();
+        a->p1=jss::make_root<X>();
+        a->p1->p1=jss::make_root<X>();
+        jss::local_ptr<X> b=a->p1->p1;
+        assert(Counted::instances==3);
+        swap(a->p1,b->p2);
+        assert(Counted::instances==1);
+        assert(!a->p1);
+    }
+    assert(Counted::instances==0);
+}
+
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+void threads_update_shared_structure(){
+    std::cout<<__FUNCTION__<<std::endl;
+    static std::atomic<unsigned> live(0);
+    struct Node:jss::internal_base{
+        jss::internal_ptr<Node> next,shared;
+        Node():next(this),shared(this){
+            ++live;
+        }
+        ~Node(){
+            --live;
+        }
+    };
+    struct Hub:jss::internal_base{
+        std::vector<jss::internal_ptr<Node>> slots;
+        Hub(unsigned n){
+            slots.reserve(n);
+            for(unsigned i=0;i<n;++i)
+                slots.emplace_back(this);
+        }
+    };
+
+    unsigned const threads=8;
+    unsigned const rounds=2000;
+    {
+        auto hub=jss::make_root<Hub>(threads);
+        std::vector<jss::root_ptr<Node>> shared;
+        for(unsigned i=0;i<4;++i)
+            shared.push_back(jss::make_root<Node>());
+        for(unsigned i=0;i<4;++i)
+            shared[i]->next=shared[(i+1)%4];
+
+        std::vector<std::thread> workers;
+        for(unsigned t=0;t<threads;++t){
+            workers.emplace_back([&,t]{
+                for(unsigned r=0;r<rounds;++r){
+                    auto keep=shared[(r+t)%4];
+                    auto a=jss::make_root<Node>();
+                    auto b=jss::make_root<Node>();
+                    a->next=b;
+                    b->next=a;
+                    a->shared=shared[r%4];
+                    b->shared=keep;
+                    hub->slots[t]=a;
+                    jss::root_ptr<Node> copy(hub->slots[t]);
+                    a.reset();
+                    b.reset();
+                    assert(copy->next->next==copy);
+                    if(r%3){
+                        copy->next->shared.reset();
+                        copy.reset();
+                        hub->slots[t].reset();
+                    } else {
+                        jss::deferred_collection batch;
+                        copy.reset();
+                        hub->slots[t].reset();
+                    }
+                }
+            });
+        }
+        for(auto& w:workers)
+            w.join();
+        assert(live==4);
+    }
+    assert(live==0);
+}
+
+void queued_drops_collected_by_collector(){
+    std::cout<<__FUNCTION__<<std::endl;
+    static std::atomic<unsigned> live(0);
+    struct Node:jss::internal_base{
+        jss::internal_ptr<Node> next;
+        Node():next(this){
+            ++live;
+        }
+        ~Node(){
+            assert(!next);
+            --live;
+        }
+    };
+
+    jss::set_queued_collection(true);
+    {
+        auto a=jss::make_root<Node>();
+        a->next=jss::make_root<Node>();
+        a->next->next=a;
+        a.reset();
+        assert(live==2);
+        assert(jss::collect_some(10)==1);
+        assert(live==0);
+        assert(jss::collect_some(10)==0);
+    }
+    jss::set_queued_collection(false);
+
+    {
+        jss::background_collector collector;
+        for(unsigned i=0;i<1000;++i){
+            auto a=jss::make_root<Node>();
+            a->next=jss::make_root<Node>();
+            a->next->next=a;
+        }
+        jss::collect();
+        assert(live==0);
+    }
+}
+
+void lock_races_with_last_drop(){
+    std::cout<<__FUNCTION__<<std::endl;
+    static std::atomic<unsigned> live(0);
+    struct Node:jss::internal_base{
+        Node(){
+            ++live;
+        }
+        ~Node(){
+            --live;
+        }
+    };
+
+    for(unsigned r=0;r<1000;++r){
+        auto node=jss::make_root<Node>();
+        jss::weak_root_ptr<Node> observer(node);
+        std::atomic<bool> go(false);
+        std::vector<std::thread> lockers;
+        for(unsigned t=0;t<4;++t){
+            lockers.emplace_back([&]{
+                while(!go)
+                    std::this_thread::yield();
+                // The lockers could keep the node alive between them
+                // forever, so each only locks a bounded number of times
+                for(unsigned i=0;i<100;++i){
+                    auto p=observer.lock();
+                    if(!p)
+                        break;
+                    std::this_thread::yield();
+                    assert(live==1);
+                }
+            });
+        }
+        go=true;
+        node.reset();
+        for(auto& locker:lockers)
+            locker.join();
+        assert(live==0);
+        assert(!observer.lock());
+    }
+}
+#endif
+
+void parallel_marking_finds_unreachable_nodes(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> left,right,other;
+        Counted data;
+
+        X():
+            left(this),right(this),other(this){}
+    };
+
+    jss::set_parallel_marking(4,64);
+    assert(jss::get_parallel_marking_threads()==4);
+    CountingResource resource;
+    auto const previous=jss::set_bookkeeping_resource(&resource);
+    {
+        jss::root_ptr<X> kept;
+        {
+            std::vector<jss::root_ptr<X>> nodes;
+            for(unsigned i=0;i<4095;++i)
+                nodes.push_back(jss::make_root<X>());
+            for(unsigned i=0;2*i+2<nodes.size();++i){
+                nodes[i]->left=nodes[2*i+1];
+                nodes[i]->right=nodes[2*i+2];
+                nodes[2*i+1]->other=nodes[2*i+2];
+                nodes[2*i+2]->other=nodes[2*i+1];
+            }
+            kept=nodes[5];
+        }
+        assert(Counted::instances==2046);
+        assert(kept->other->left->other);
+    }
+    assert(Counted::instances==0);
+    assert(resource.outstanding>0);
+    jss::set_bookkeeping_resource(previous);
+    assert(resource.outstanding==0);
+    jss::set_parallel_marking(1);
+    assert(jss::get_parallel_marking_threads()==1);
+}
+
+void weak_pointers_do_not_keep_nodes_reachable(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct Node:jss::internal_base{
+        jss::internal_ptr<Node> child;
+        jss::weak_internal_ptr<Node> parent;
+        Counted data;
+
+        Node():
+            child(this),parent(this){}
+    };
+
+    jss::weak_root_ptr<Node> observer;
+    {
+        auto root=jss::make_root<Node>();
+        root->child=jss::make_pooled_root<Node>();
+        root->child->parent=root;
+        root->child->child=jss::make_root<Node>();
+        root->child->child->parent=root->child;
+        observer=root->child;
+        assert(root->child->parent.get()==root.get());
+        assert(observer.get()==root->child.get());
+        assert(root.use_count()==1);
+        assert(root->child.use_count()==1);
+
+        auto grandchild=observer.lock();
+        assert(grandchild==root->child);
+        grandchild=root->child->child;
+        jss::reset_reachability_cache_stats();
+        root->child.reset();
+        assert(jss::get_reachability_cache_stats().searches==0);
+        assert(Counted::instances==2);
+        assert(observer.expired());
+        assert(!observer.lock());
+        assert(grandchild->parent.get()==nullptr);
+        grandchild->parent=root;
+        assert(grandchild->parent->child==nullptr);
+    }
+    assert(Counted::instances==0);
+    assert(!observer);
+    jss::weak_root_ptr<Node> copy(observer);
+    observer.reset();
+    assert(!copy.lock());
+}
+
+void lock_does_not_depend_on_deferral(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct Node:jss::internal_base{
+        jss::internal_ptr<Node> next;
+        Counted data;
+
+        Node():
+            next(this){}
+    };
+
+    auto kept=jss::make_root<Node>();
+    for(unsigned deferred=0;deferred!=2;++deferred){
+        jss::weak_root_ptr<Node> single,cycle,held;
+        {
+            std::unique_ptr<jss::deferred_collection> batch;
+            if(deferred)
+                batch.reset(new jss::deferred_collection);
+            {
+                auto a=jss::make_root<Node>();
+                single=a;
+                auto b=jss::make_root<Node>();
+                b->next=jss::make_root<Node>();
+                b->next->next=b;
+                cycle=b;
+                kept->next=jss::make_root<Node>();
+                held=kept->next;
+            }
+            assert(!single.lock());
+            assert(!cycle.lock());
+            assert(held.lock()==kept->next);
+        }
+        assert(Counted::instances==2);
+        assert(held.lock());
+    }
+    kept.reset();
+    assert(Counted::instances==0);
+}
+
+void threads_drop_independent_structures(){
+    std::cout<<__FUNCTION__<<std::endl;
+    static std::atomic<unsigned> live(0);
+    struct Node:jss::internal_base{
+        jss::internal_ptr<Node> next,back;
+        Node():next(this),back(this){
+            ++live;
+        }
+        ~Node(){
+            --live;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(unsigned t=0;t<2;++t){
+        threads.emplace_back([]{
+            for(unsigned r=0;r<200;++r){
+                auto head=jss::make_root<Node>();
+                auto tail=head;
+                for(unsigned i=0;i<50;++i){
+                    tail->next=jss::make_root<Node>();
+                    tail->next->back=tail;
+                    tail=tail->next;
+                }
+                tail->next=head;
+                tail.reset();
+                head->next->next.reset();
+                head.reset();
+            }
+        });
+    }
+    for(auto& t:threads)
+        t.join();
+    assert(live==0);
+}
+
+void threads_share_parallel_marking(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct X:jss::internal_base{
+        jss::internal_ptr<X> left,right,other;
+        unsigned& live;
+        X(unsigned& live_):left(this),right(this),other(this),live(live_){
+            ++live;
+        }
+        ~X(){
+            --live;
+        }
+    };
+
+    jss::set_parallel_marking(4,64);
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> threads;
+    for(unsigned t=0;t<2;++t){
+        threads.emplace_back([&]{
+            unsigned live=0;
+            for(unsigned r=0;r<20;++r){
+                jss::root_ptr<X> kept;
+                {
+                    std::vector<jss::root_ptr<X>> nodes;
+                    for(unsigned i=0;i<1023;++i)
+                        nodes.push_back(jss::make_root<X>(live));
+                    for(unsigned i=0;2*i+2<nodes.size();++i){
+                        nodes[i]->left=nodes[2*i+1];
+                        nodes[i]->right=nodes[2*i+2];
+                        nodes[2*i+1]->other=nodes[2*i+2];
+                        nodes[2*i+2]->other=nodes[2*i+1];
+                    }
+                    kept=nodes[5];
+                }
+                if(live!=510)
+                    ok=false;
+                kept.reset();
+                if(live!=0)
+                    ok=false;
+            }
+        });
+    }
+    for(auto& t:threads)
+        t.join();
+    assert(ok);
+    jss::set_parallel_marking(1);
+}
+
+void threads_share_reachability_proofs(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct Node:jss::internal_base{
+        jss::internal_ptr<Node> next,back;
+        unsigned& live;
+        Node(unsigned& live_):next(this),back(this),live(live_){
+            ++live;
+        }
+        ~Node(){
+            --live;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    std::atomic<bool> ok(true);
+    for(unsigned t=0;t<2;++t){
+        threads.emplace_back([&]{
+            unsigned live=0;
+            {
+                auto root=jss::make_root<Node>(live);
+                for(unsigned r=0;r<300;++r){
+                    auto tail=jss::root_ptr<Node>(root);
+                    for(unsigned i=0;i<20;++i){
+                        tail->next=jss::make_root<Node>(live);
+                        tail->next->back=tail;
+                        tail=tail->next;
+                    }
+                    tail.reset();
+                    jss::root_ptr<Node> middle(root->next->next->next);
+                    middle->back.reset();
+                    middle.reset();
+                    if(live!=21)
+                        ok=false;
+                    root->next->next->next.reset();
+                    if(live!=3)
+                        ok=false;
+                    root->next.reset();
+                    if(live!=1)
+                        ok=false;
+                }
+            }
+            if(live)
+                ok=false;
+        });
+    }
+    for(auto& t:threads)
+        t.join();
+    assert(ok);
+}
+
+void for_each_reachable_visits_each_node_once(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct Node:jss::internal_base{
+        jss::internal_ptr<Node> left,right;
+        unsigned depth;
+        unsigned visits=0;
+
+        Node(unsigned depth_):
+            left(this),right(this),depth(depth_){}
+    };
+
+    auto root=jss::make_root<Node>(0);
+    root->left=jss::make_root<Node>(1);
+    root->right=jss::make_root<Node>(1);
+    root->left->left=jss::make_root<Node>(2);
+    root->left->right=root->right;
+    root->right->left=root->left->left;
+    root->right->right=jss::make_root<Node>(2);
+    root->right->right->left=root;
+    root->right->right->right=jss::make_root<Node>(3);
+    auto outside=jss::make_root<Node>(0);
+    outside->left=root;
+
+    unsigned count=0;
+    assert(jss::for_each_reachable(root,[&](Node& node){
+        ++node.visits;
+        ++count;
+    }));
+    assert(count==6);
+    assert(root->visits==1);
+    assert(root->right->left->visits==1);
+    assert(outside->visits==0);
+
+    unsigned last_depth=0;
+    count=0;
+    assert(jss::for_each_reachable(root,[&](Node& node){
+        assert(node.depth>=last_depth);
+        last_depth=node.depth;
+        ++count;
+    },jss::traversal_order::breadth_first));
+    assert(count==6);
+    assert(last_depth==3);
+
+    count=0;
+    assert(!jss::for_each_reachable(root,[&](Node&){
+        return ++count<3;
+    }));
+    assert(count==3);
+    assert(jss::for_each_reachable(jss::root_ptr<Node>(),[](Node&){
+        assert(false);
+    }));
+}
+
+void for_each_reachable_visits_objects_of_the_given_type(){
+    std::cout<<__FUNCTION__<<std::endl;
+    struct Tagged{
+        virtual ~Tagged(){}
+        int tag=0;
+    };
+    struct Node:jss::internal_base{
+        jss::internal_ptr<Node> next;
+        jss::internal_ptr<jss::internal_base> other;
+
+        Node():
+            next(this),other(this){}
+    };
+    struct Leaf:Tagged,Node{
+        Leaf(int tag_){
+            tag=tag_;
+        }
+    };
+    struct Plain:jss::internal_base{
+        jss::internal_ptr<Node> next;
+
+        Plain():
+            next(this){}
+    };
+
+    jss::root_arena arena;
+    auto root=jss::make_root<Node>();
+    auto first=jss::make_root<Leaf>(1);
+    root->next=first;
+    first->next=arena.make_root<Leaf>(3);
+    first->next->next=arena.make_root<Node>();
+    auto plain=jss::make_root<Plain>();
+    plain->next=jss::make_root<Leaf>(5);
+    root->other=plain;
+    plain.reset();
+
+    unsigned nodes=0;
+    assert(jss::for_each_reachable(root,[&](Node& node){
+        assert(!node.next || node.next.get()!=&node);
+        ++nodes;
+    }));
+    assert(nodes==2);
+
+    int tags=0;
+    assert(jss::for_each_reachable(first,[&](Leaf& leaf){
+        tags+=leaf.tag;
+    }));
+    assert(tags==4);
+
+    unsigned tagged_bases=0;
+    assert(jss::for_each_reachable(jss::root_ptr<Tagged>(first),[&](Tagged&){
+        ++tagged_bases;
+    }));
+    assert(tagged_bases==0);
+
+    unsigned objects=0;
+    assert(jss::for_each_reachable(jss::root_ptr<jss::internal_base>(root),[&](jss::internal_base&){
+        ++objects;
+    }));
+    assert(objects==6);
+}
+
 int main(){
     root_ptr_destroys_object_when_destroyed();
     internal_ptr_destroys_object_when_destroyed();
@@ -683,4 +1963,34 @@ int main(){
     can_convert_root_ptr_to_local_ptr();
     vector_of_internal_ptr();
     pointers_are_null_in_destructor();
+    node_with_changing_number_of_parents();
+    hub_with_many_parents();
+    destructor_drops_other_structure();
+    large_graph_with_cycles_destroyed();
+    deferred_collection_batches_drops();
+    trial_deletion_engine();
+    repeated_drops_reuse_reachability_proofs();
+    dying_structure_with_reachable_children();
+    pooled_roots_reuse_slab_memory();
+    pooled_roots_respect_over_alignment();
+    allocate_root_uses_allocator();
+    bookkeeping_uses_memory_resource();
+    back_pointer_storage_grows_and_shrinks();
+    arena_released_as_a_whole();
+    pointers_removed_from_middle_of_node();
+    internal_ptr_vector_edges();
+    moves_and_swaps_within_a_node_do_not_scan();
+    parallel_marking_finds_unreachable_nodes();
+    weak_pointers_do_not_keep_nodes_reachable();
+    lock_does_not_depend_on_deferral();
+    threads_drop_independent_structures();
+    threads_share_reachability_proofs();
+    threads_share_parallel_marking();
+    for_each_reachable_visits_each_node_once();
+    for_each_reachable_visits_objects_of_the_given_type();
+#ifdef JSS_INTERNAL_PTR_THREAD_SAFE
+    threads_update_shared_structure();
+    queued_drops_collected_by_collector();
+    lock_races_with_last_drop();
+#endif
 }